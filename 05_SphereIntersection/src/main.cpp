@@ -5,6 +5,12 @@
 
 #include <iostream>
 
+// stage_bench.sh builds every stage at one size and sample count by
+// defining these; a plain build renders the chapter's image.
+#ifndef STAGE_IMAGE_WIDTH
+#define STAGE_IMAGE_WIDTH 400
+#endif
+
 // Sphere equation with radius r and center at point C.
 // Let P be a point on the sphere then:
 // P = (Px,Py,Pz), C = (Cx,Cy,Cz)
@@ -58,7 +64,7 @@ int main(int argc, char **argv)
     // Image
 
     const auto aspect_ratio = 16.0 / 9.0;
-    const int  image_width  = 400;
+    const int  image_width  = STAGE_IMAGE_WIDTH;
     const int  image_height = static_cast<int>(image_width / aspect_ratio);
 
     // Camera
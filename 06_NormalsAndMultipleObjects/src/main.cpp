@@ -9,6 +9,12 @@
 
 #include <iostream>
 
+// stage_bench.sh builds every stage at one size and sample count by
+// defining these; a plain build renders the chapter's image.
+#ifndef STAGE_IMAGE_WIDTH
+#define STAGE_IMAGE_WIDTH 400
+#endif
+
 // If the cast ray hits the sphere t will be the value used to
 // compute the point of intersection.  Create a new ray from the
 // center of the sphere to this point.  This vector is the
@@ -39,7 +45,7 @@ int main(int argc, char **argv)
     // Image
 
     const auto aspect_ratio = 16.0 / 9.0;
-    const int  image_width  = 400;
+    const int  image_width  = STAGE_IMAGE_WIDTH;
     const int  image_height = static_cast<int>(image_width / aspect_ratio);
 
     // World
@@ -10,6 +10,18 @@
 
 #include <iostream>
 
+// stage_bench.sh builds every stage at one size and sample count by
+// defining these; a plain build renders the chapter's image.
+#ifndef STAGE_IMAGE_WIDTH
+#define STAGE_IMAGE_WIDTH 400
+#endif
+#ifndef STAGE_SAMPLES_PER_PIXEL
+#define STAGE_SAMPLES_PER_PIXEL 100
+#endif
+#ifndef STAGE_MAX_DEPTH
+#define STAGE_MAX_DEPTH 50
+#endif
+
 // If the cast ray hits the sphere t will be the value used to
 // compute the point of intersection.  Create a new ray from the
 // center of the sphere to this point.  This vector is the
@@ -60,10 +72,10 @@ int main(int argc, char **argv)
     // Image
 
     const auto aspect_ratio      = 16.0 / 9.0;
-    const int  image_width       = 400;
+    const int  image_width       = STAGE_IMAGE_WIDTH;
     const int  image_height      = static_cast<int>(image_width / aspect_ratio);
-    const int  samples_per_pixel = 100;
-    const int  max_depth         = 50;
+    const int  samples_per_pixel = STAGE_SAMPLES_PER_PIXEL;
+    const int  max_depth         = STAGE_MAX_DEPTH;
 
     // World
 
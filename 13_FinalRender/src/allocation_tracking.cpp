@@ -0,0 +1,66 @@
+#include "allocation_tracking.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Counting replacements for the global allocation functions; see
+// allocation_tracking.h.  Built into the renderer only when configured with
+// RT_TRACK_ALLOCATIONS.  Every form of operator new funnels into allocate and
+// every operator delete into free, so sized, aligned and nothrow allocations
+// are all counted.
+
+std::atomic<std::uint64_t> total_allocations{0};
+std::atomic<std::uint64_t> total_allocated_bytes{0};
+thread_local std::uint64_t thread_allocation_count = 0;
+
+static void *allocate(std::size_t size, std::size_t alignment)
+{
+    ++thread_allocation_count;
+    total_allocations.fetch_add(1, std::memory_order_relaxed);
+    total_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+
+    if (size == 0)
+        size = 1;
+    if (alignment <= alignof(std::max_align_t))
+        return std::malloc(size);
+    // aligned_alloc wants a size that is a multiple of the alignment.
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+static void *allocate_or_throw(std::size_t size, std::size_t alignment)
+{
+    void *p = allocate(size, alignment);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new(std::size_t size) { return allocate_or_throw(size, 0); }
+void *operator new[](std::size_t size) { return allocate_or_throw(size, 0); }
+void *operator new(std::size_t size, std::align_val_t a) { return allocate_or_throw(size, static_cast<std::size_t>(a)); }
+void *operator new[](std::size_t size, std::align_val_t a) { return allocate_or_throw(size, static_cast<std::size_t>(a)); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return allocate(size, 0); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return allocate(size, 0); }
+void *operator new(std::size_t size, std::align_val_t a, const std::nothrow_t &) noexcept
+{
+    return allocate(size, static_cast<std::size_t>(a));
+}
+void *operator new[](std::size_t size, std::align_val_t a, const std::nothrow_t &) noexcept
+{
+    return allocate(size, static_cast<std::size_t>(a));
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { std::free(p); }
@@ -0,0 +1,111 @@
+#ifndef ALLOCATION_TRACKING_H
+#define ALLOCATION_TRACKING_H
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+
+// Heap allocation counts, for checking that rendering never allocates per
+// ray or per sample.
+//
+// Configure with -DRT_TRACK_ALLOCATIONS=ON to build allocation_tracking.cpp
+// into the renderer.  It replaces the global operator new and delete with
+// ones that count every allocation, both in total and for the calling
+// thread.  render_pixel holds a hot_path_guard, which adds whatever its
+// thread allocated while tracing to hot_path_allocations; the renderer
+// reports the count per phase and fails if that one is not zero.
+//
+// In ordinary builds the counts read as zero and the guard is empty, so none
+// of this costs anything.
+
+struct allocation_count
+{
+    std::uint64_t allocations = 0;
+    std::uint64_t bytes       = 0;
+};
+
+#ifdef RT_TRACK_ALLOCATIONS
+
+const bool allocation_tracking = true;
+
+// Maintained by the operators in allocation_tracking.cpp.  The totals are
+// relaxed atomics, which cost nothing worth measuring while the hot path
+// itself does not allocate.
+extern std::atomic<std::uint64_t> total_allocations;
+extern std::atomic<std::uint64_t> total_allocated_bytes;
+extern thread_local std::uint64_t thread_allocation_count;
+
+inline allocation_count allocations_so_far()
+{
+    return {total_allocations.load(std::memory_order_relaxed), total_allocated_bytes.load(std::memory_order_relaxed)};
+}
+
+inline std::uint64_t thread_allocations() { return thread_allocation_count; }
+
+#else
+
+const bool allocation_tracking = false;
+
+inline allocation_count allocations_so_far() { return {}; }
+inline std::uint64_t    thread_allocations() { return 0; }
+
+#endif
+
+// Allocations made while tracing rays, on any thread.
+inline std::atomic<std::uint64_t> hot_path_allocations{0};
+
+// Adds to hot_path_allocations whatever its own thread allocates during its
+// lifetime.  Only the owning thread is counted, so other threads encoding or
+// writing meanwhile are not blamed on the render.
+class hot_path_guard
+{
+  public:
+#ifdef RT_TRACK_ALLOCATIONS
+    hot_path_guard() : start{thread_allocations()} {}
+    ~hot_path_guard()
+    {
+        if (auto n = thread_allocations() - start; n != 0)
+            hot_path_allocations.fetch_add(n, std::memory_order_relaxed);
+    }
+
+  private:
+    std::uint64_t start;
+#endif
+};
+
+// Counts the allocations made by all threads in successive phases of a run.
+class allocation_phases
+{
+  public:
+    allocation_phases() : start{allocations_so_far()} {}
+
+    // Print the allocations since construction or the last report as those
+    // of the named phase.  Does nothing unless allocations are tracked.
+    void report(std::ostream &out, const char *name)
+    {
+        if (!allocation_tracking)
+            return;
+        auto now = allocations_so_far();
+        out << "Allocations during " << name << ": " << now.allocations - start.allocations << " ("
+            << static_cast<double>(now.bytes - start.bytes) / 1.0e6 << " MB)\n";
+        start = now;
+    }
+
+  private:
+    allocation_count start;
+};
+
+// Report the allocations made while tracing rays.  Returns false if there
+// were any.
+inline bool check_hot_path(std::ostream &out)
+{
+    if (!allocation_tracking)
+        return true;
+    auto n = hot_path_allocations.load();
+    out << "Allocations while tracing rays: " << n << '\n';
+    if (n != 0)
+        out << "Rendering must not allocate per ray or per sample.\n";
+    return n == 0;
+}
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "perf_counters.h"
+#include "region.h"
+#include "render.h"
+#include "spsc_queue.h"
+#include "tonemap.h"
+#include "trace.h"
+#include "vec3.h"
+#include "video.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Camera fly-throughs.  A camera path is a text file of keyframes, one per
+// line, with '#' starting a comment:
+//
+//   # frame  lookfrom   lookat  vfov  aperture  focus_dist
+//   0        13 2 3     0 0 0   20    0.1       10
+//   48       8 3 -6     0 0 0   30    0.1       10
+//
+// Frames are numbered from the first key to the last.  The eye and target
+// follow a Catmull-Rom spline through the keys, so the camera does not jerk
+// as it passes one; the lens settings are interpolated linearly.
+
+struct camera_key
+{
+    int    frame      = 0;
+    point3 lookfrom   = {13, 2, 3};
+    point3 lookat     = {0, 0, 0};
+    double vfov       = 20;
+    double aperture   = 0.1;
+    double focus_dist = 10;
+};
+
+// Returns false, after reporting the problem on err, if the file cannot be
+// read or a line is malformed.  Keys must be in increasing frame order.
+inline bool read_camera_path(const std::string &path, std::vector<camera_key> &keys, std::ostream &err)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        err << "Cannot open camera path " << path << '\n';
+        return false;
+    }
+
+    std::string line;
+    for (int line_number = 1; std::getline(in, line); ++line_number)
+    {
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+
+        std::istringstream fields(line);
+        camera_key         key;
+        double             from[3];
+        double             at[3];
+        std::string        extra;
+        fields >> key.frame >> from[0] >> from[1] >> from[2] >> at[0] >> at[1] >> at[2] >> key.vfov >> key.aperture >> key.focus_dist;
+        if (!fields || (fields >> extra) || key.vfov <= 0 || key.vfov >= 180 || key.aperture < 0 || key.focus_dist <= 0)
+        {
+            err << path << ':' << line_number << ": expected frame, lookfrom x y z, lookat x y z, vfov, aperture "
+                << "and focus_dist\n";
+            return false;
+        }
+        if (!keys.empty() && key.frame <= keys.back().frame)
+        {
+            err << path << ':' << line_number << ": frame " << key.frame << " does not follow frame "
+                << keys.back().frame << '\n';
+            return false;
+        }
+        key.lookfrom = point3(from[0], from[1], from[2]);
+        key.lookat   = point3(at[0], at[1], at[2]);
+        keys.push_back(key);
+    }
+
+    if (keys.empty())
+    {
+        err << "Camera path " << path << " has no keyframes\n";
+        return false;
+    }
+    return true;
+}
+
+inline point3 catmull_rom(const point3 &p0, const point3 &p1, const point3 &p2, const point3 &p3, double t)
+{
+    auto t2 = t * t;
+    auto t3 = t2 * t;
+    return 0.5 * ((2.0 * p1) + (p2 - p0) * t + (2.0 * p0 - 5.0 * p1 + 4.0 * p2 - p3) * t2 +
+                  (3.0 * p1 - p0 - 3.0 * p2 + p3) * t3);
+}
+
+// The camera settings for a frame between the first and last key.
+inline camera_key camera_at(const std::vector<camera_key> &keys, int frame)
+{
+    if (frame <= keys.front().frame)
+        return keys.front();
+    if (frame >= keys.back().frame)
+        return keys.back();
+
+    std::size_t i = 0;
+    while (keys[i + 1].frame <= frame)
+        ++i;
+    const auto &k0 = keys[i == 0 ? 0 : i - 1];
+    const auto &k1 = keys[i];
+    const auto &k2 = keys[i + 1];
+    const auto &k3 = keys[std::min(i + 2, keys.size() - 1)];
+
+    double     t = static_cast<double>(frame - k1.frame) / (k2.frame - k1.frame);
+    camera_key key;
+    key.frame      = frame;
+    key.lookfrom   = catmull_rom(k0.lookfrom, k1.lookfrom, k2.lookfrom, k3.lookfrom, t);
+    key.lookat     = catmull_rom(k0.lookat, k1.lookat, k2.lookat, k3.lookat, t);
+    key.vfov       = k1.vfov + t * (k2.vfov - k1.vfov);
+    key.aperture   = k1.aperture + t * (k2.aperture - k1.aperture);
+    key.focus_dist = k1.focus_dist + t * (k2.focus_dist - k1.focus_dist);
+    return key;
+}
+
+// Render every frame of the path over the same resident world and write them
+// to out as one video stream.  A writer thread converts and writes each frame
+// while the workers render the next, the two sides trading a pair of frame
+// buffers through lock-free queues.  Each frame is flushed as it completes so
+// an encoder reading the stream never waits on our buffering.
+inline void render_animation(const hittable &world, render_settings settings, const render_region &region,
+                             const std::vector<camera_key> &keys, int tile_size, int thread_count, std::ostream &out,
+                             image_format format, int fps, const tonemap &tone)
+{
+    const int frame_buffers = 2;
+
+    auto   bounds = region.bounds();
+    auto   aspect = static_cast<double>(settings.image_width) / settings.image_height;
+    int    first  = keys.front().frame;
+    int    frames = keys.back().frame - first + 1;
+    vec3   vup(0, 1, 0);
+
+    std::vector<std::vector<std::uint8_t>> buffers(frame_buffers);
+    spsc_queue<int>                        empty(frame_buffers);
+    spsc_queue<int>                        finished(frame_buffers + 1);
+    for (int b = 0; b < frame_buffers; ++b)
+        empty.push(b);
+
+    video_writer video(out, format, bounds.width(), bounds.height(), fps);
+    out.flush();
+
+    std::thread writer(
+        [&]()
+        {
+            trace_track track("frame writer");
+            perf_scope  counters(perf_phase::output);
+            for (int b = finished.pop(); b >= 0; b = finished.pop())
+            {
+                trace_span span("write frame", "output");
+                video.write_frame(buffers[b].data());
+                out.flush();
+                empty.push(b);
+            }
+        });
+
+    framebuffer image(bounds.width(), bounds.height());
+    for (int f = 0; f < frames; ++f)
+    {
+        auto   key = camera_at(keys, first + f);
+        camera cam(key.lookfrom, key.lookat, vup, key.vfov, aspect, key.aperture, key.focus_dist);
+
+        settings.frame = first + f;
+        trace_span frame("frame", "render", {{"frame", settings.frame}});
+        render_tiles(cam, world, settings, region, tile_size, thread_count, framebuffer_sink(image, bounds));
+
+        int b = empty.pop();
+        trace_span convert("quantize", "output");
+        buffers[b] = quantize(image, tone, thread_count);
+        finished.push(b);
+    }
+    finished.push(-1);
+    writer.join();
+}
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef ASYNC_FILE_H
+#define ASYNC_FILE_H
+
+#include "perf_counters.h"
+#include "spsc_queue.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if __has_include(<unistd.h>)
+#include <fcntl.h>
+#include <unistd.h>
+#define RT_HAVE_POSIX_IO 1
+#else
+#include <cstdio>
+#define RT_HAVE_POSIX_IO 0
+#endif
+
+// Output file written by its own thread.
+//
+// Whatever is streamed in (by an encoder, usually) is copied into one of a few
+// large aligned blocks.  Full blocks go to the writer thread through a
+// lock-free queue and come back empty through a second one, so the thread
+// producing the bytes only waits for the disk when every block is in flight.
+// Where the platform has O_DIRECT the file bypasses the page cache: the
+// blocks are aligned for it and a few hundred megabytes of output do not
+// evict the scene and framebuffer from memory.  File systems that refuse
+// O_DIRECT get ordinary buffered writes.
+
+class async_file : public std::streambuf
+{
+  public:
+    async_file() {}
+    async_file(const async_file &)            = delete;
+    async_file &operator=(const async_file &) = delete;
+    ~async_file() override { close(std::cerr); }
+
+    // Create (or truncate) path and start the writer thread.  Returns false
+    // and reports on err if the file cannot be created.
+    bool open(const std::string &path, std::ostream &err)
+    {
+        file_path = path;
+        for (int b = 0; b < block_count; ++b)
+        {
+            auto *block = static_cast<char *>(std::aligned_alloc(alignment, block_size));
+            if (block == nullptr)
+            {
+                err << "Cannot allocate the output buffers for " << path << '\n';
+                free_blocks();
+                return false;
+            }
+            blocks.push_back(block);
+        }
+
+#if RT_HAVE_POSIX_IO
+#ifdef O_DIRECT
+        fd     = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        direct = fd >= 0;
+#endif
+        if (fd < 0)
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+#else
+        file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr)
+#endif
+        {
+            err << "Cannot create " << path << ": " << std::strerror(errno) << '\n';
+            free_blocks();
+            return false;
+        }
+
+        // Filled before the writer starts; from then on only it returns blocks.
+        for (int b = 0; b < block_count; ++b)
+            empty.push(b);
+        start_block();
+        writer = std::thread([this]() { write_blocks(); });
+        return true;
+    }
+
+    // Write out what is buffered, wait for the writer thread and close the
+    // file.  Returns false, after reporting the problem on err, if any write
+    // failed.  Does nothing if the file was never opened.
+    bool close(std::ostream &err)
+    {
+        if (!writer.joinable())
+            return true;
+
+        send_block();
+        full.push({-1, 0});
+        writer.join();
+
+#if RT_HAVE_POSIX_IO
+        // The last block was padded out to the O_DIRECT alignment.
+        if (padded && write_error == 0 && ::ftruncate(fd, static_cast<off_t>(bytes_written)) != 0)
+            write_error = errno;
+        if (::close(fd) != 0 && write_error == 0)
+            write_error = errno;
+        fd = -1;
+#else
+        if (std::fclose(file) != 0 && write_error == 0)
+            write_error = errno;
+        file = nullptr;
+#endif
+        free_blocks();
+
+        if (write_error != 0)
+        {
+            err << "Could not write " << file_path << ": " << std::strerror(write_error) << '\n';
+            return false;
+        }
+        return true;
+    }
+
+    // How much was written and how long the producer spent waiting for the
+    // disk; call after close.
+    void report(std::ostream &err) const
+    {
+        err << "Wrote " << static_cast<double>(bytes_written) / 1.0e6 << " MB to " << file_path
+            << (direct ? " with O_DIRECT" : "") << "; output waited " << stall_seconds * 1000.0
+            << " ms for the disk.\n";
+    }
+
+  protected:
+    int overflow(int c) override
+    {
+        send_block();
+        start_block();
+        if (c != traits_type::eof())
+        {
+            *pptr() = static_cast<char>(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n) override
+    {
+        auto left = n;
+        while (left > 0)
+        {
+            if (pptr() == epptr())
+                overflow(traits_type::eof());
+            auto count = std::min<std::streamsize>(left, epptr() - pptr());
+            std::memcpy(pptr(), s, static_cast<std::size_t>(count));
+            pbump(static_cast<int>(count));
+            s += count;
+            left -= count;
+        }
+        return n;
+    }
+
+  private:
+    static constexpr std::size_t block_size  = std::size_t{1} << 20;
+    static constexpr std::size_t alignment   = 4096;
+    static constexpr int         block_count = 4;
+
+    struct filled_block
+    {
+        int         index;
+        std::size_t size;
+    };
+
+    // Take an empty block, waiting for the writer to return one if need be.
+    void start_block()
+    {
+        int index = current;
+        if (index < 0 && !empty.try_pop(index))
+        {
+            auto start = std::chrono::steady_clock::now();
+            index      = empty.pop();
+            stall_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        current = index;
+        setp(blocks[index], blocks[index] + block_size);
+    }
+
+    // Hand the current block to the writer.  One with nothing in it stays
+    // here for start_block to reuse, since pushing it back onto empty would
+    // make this thread a second producer of that queue.
+    void send_block()
+    {
+        auto size = static_cast<std::size_t>(pptr() - pbase());
+        if (size > 0)
+        {
+            full.push({current, size});
+            current = -1;
+        }
+        setp(nullptr, nullptr);
+    }
+
+    void free_blocks()
+    {
+        for (auto *block : blocks)
+            std::free(block);
+        blocks.clear();
+    }
+
+    void write_blocks()
+    {
+        trace_track track("file writer");
+        perf_scope  counters(perf_phase::output);
+        for (auto block = full.pop(); block.index >= 0; block = full.pop())
+        {
+            trace_span span("write", "io", {{"bytes", static_cast<std::int64_t>(block.size)}});
+            if (write_error == 0)
+                write_block(blocks[block.index], block.size);
+            empty.push(block.index);
+        }
+    }
+
+    void write_block(char *data, std::size_t size)
+    {
+        bytes_written += size;
+#if RT_HAVE_POSIX_IO
+        // O_DIRECT transfers whole aligned blocks; close trims the padding.
+        if (direct && size % alignment != 0)
+        {
+            auto padded_size = (size + alignment - 1) / alignment * alignment;
+            std::memset(data + size, 0, padded_size - size);
+            size   = padded_size;
+            padded = true;
+        }
+        while (size > 0)
+        {
+            auto n = ::write(fd, data, size);
+            if (n < 0 && errno == EINTR)
+                continue;
+#ifdef O_DIRECT
+            if (n < 0 && errno == EINVAL && direct)
+            {
+                // The file system accepted O_DIRECT at open but not for
+                // writes; carry on through the page cache.
+                ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_DIRECT);
+                direct = false;
+                continue;
+            }
+#endif
+            if (n <= 0)
+            {
+                write_error = n < 0 ? errno : EIO;
+                return;
+            }
+            data += n;
+            size -= static_cast<std::size_t>(n);
+        }
+#else
+        if (std::fwrite(data, 1, size, file) != size)
+            write_error = errno != 0 ? errno : EIO;
+#endif
+    }
+
+    std::string              file_path;
+    std::vector<char *>      blocks;
+    spsc_queue<int>          empty{block_count};
+    spsc_queue<filled_block> full{block_count + 1};
+    int                      current = -1; // the block being filled, if any
+    std::thread              writer;
+    double                   stall_seconds = 0.0;
+
+    // Owned by the writer thread until close joins it.
+    std::uint64_t bytes_written = 0;
+    int           write_error   = 0;
+    bool          direct        = false;
+    bool          padded        = false;
+#if RT_HAVE_POSIX_IO
+    int fd = -1;
+#else
+    std::FILE *file = nullptr;
+#endif
+};
+
+#endif
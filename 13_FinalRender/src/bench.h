@@ -0,0 +1,252 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if __has_include(<unistd.h>)
+#include <fstream>
+#include <sys/resource.h>
+#include <unistd.h>
+#define RT_HAVE_UNISTD 1
+#else
+#define RT_HAVE_UNISTD 0
+#endif
+
+// A small benchmark harness, enough for timing kernels from nanoseconds to
+// seconds without a dependency.
+//
+// Each benchmark is a callable run once per iteration.  The harness doubles
+// the iteration count until a batch takes a tenth of the time budget, then
+// times several repetitions of batches sized to fill it and keeps the
+// median, so one preempted repetition does not move the result.  Results
+// print as a table while running and can be written as JSON in the layout
+// Google Benchmark uses, which existing comparison tools read.
+
+// Keep the compiler from deleting a computation whose result is unused.
+template <typename T>
+inline void do_not_optimize(const T &value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const T *sink;
+    sink = &value;
+#endif
+}
+
+// Bytes of the process resident now, and at most so far; 0 where the
+// platform does not say.
+inline std::uint64_t resident_bytes()
+{
+#if RT_HAVE_UNISTD
+    std::ifstream statm("/proc/self/statm");
+    std::uint64_t size = 0, resident = 0;
+    if (statm >> size >> resident)
+        return resident * static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+#endif
+    return 0;
+}
+
+inline std::uint64_t peak_resident_bytes()
+{
+#if RT_HAVE_UNISTD
+    rusage usage{};
+    if (::getrusage(RUSAGE_SELF, &usage) == 0)
+        return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024; // kilobytes on Linux
+#endif
+    return 0;
+}
+
+// The local time now, as ISO 8601.
+inline std::string bench_timestamp()
+{
+    char        date[32] = "";
+    std::time_t now      = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", std::localtime(&now));
+    return date;
+}
+
+inline std::string bench_host()
+{
+#if RT_HAVE_UNISTD
+    char name[256] = "";
+    if (::gethostname(name, sizeof(name) - 1) == 0)
+        return name;
+#endif
+    return "unknown";
+}
+
+// The processor's marketing name, from /proc/cpuinfo where there is one.
+inline std::string bench_cpu_model()
+{
+#if RT_HAVE_UNISTD
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string   line;
+    while (std::getline(cpuinfo, line))
+    {
+        auto colon = line.find(':');
+        if (line.rfind("model name", 0) == 0 && colon != std::string::npos && colon + 2 <= line.size())
+            return line.substr(colon + 2);
+    }
+#endif
+    return "unknown";
+}
+
+inline std::string bench_compiler()
+{
+    std::ostringstream s;
+#if defined(__clang__)
+    s << "clang " << __clang_major__ << '.' << __clang_minor__;
+#elif defined(__GNUC__)
+    s << "gcc " << __GNUC__ << '.' << __GNUC_MINOR__;
+#else
+    s << "unknown";
+#endif
+    return s.str();
+}
+
+inline const char *bench_build_type()
+{
+#ifdef NDEBUG
+    return "release";
+#else
+    return "debug";
+#endif
+}
+
+struct bench_result
+{
+    std::string   name;
+    std::uint64_t iterations = 0;   // per repetition
+    double        ns_per_op  = 0;   // median of the repetitions
+    double        min_ns     = 0;
+    double        max_ns     = 0;
+    double        items      = 0;   // optional work per iteration, such as rays
+    std::string   label      = {};
+
+    // Further figures written with the result, such as a scaling efficiency.
+    std::vector<std::pair<std::string, double>> counters = {};
+
+    // Nanoseconds per iteration of every repetition, for comparing runs.
+    std::vector<double> times = {};
+};
+
+struct bench_settings
+{
+    double      min_time    = 0.5; // seconds per benchmark
+    int         repetitions = 5;
+    std::string filter      = {};  // run only names containing this
+};
+
+class bench_runner
+{
+  public:
+    explicit bench_runner(const bench_settings &s, std::ostream &log = std::cerr) : settings{s}, out{log} {}
+
+    bool selected(const std::string &name) const
+    {
+        return settings.filter.empty() || name.find(settings.filter) != std::string::npos;
+    }
+
+    // Time body(), which does one iteration of the benchmark.  items is the
+    // work one iteration stands for, reported as a rate when not zero.
+    template <typename F>
+    void run(const std::string &name, F &&body, double items = 0, const std::string &label = {})
+    {
+        if (!selected(name))
+            return;
+
+        using clock     = std::chrono::steady_clock;
+        auto batch      = [&](std::uint64_t n)
+        {
+            auto start = clock::now();
+            for (std::uint64_t i = 0; i < n; ++i)
+                body();
+            return std::chrono::duration<double>(clock::now() - start).count();
+        };
+        auto repetition = settings.min_time / settings.repetitions;
+
+        std::uint64_t n = 1;
+        for (double t = batch(n); t < repetition / 10 && n < (std::uint64_t{1} << 40); t = batch(n))
+            n *= 2;
+        auto per = batch(n) / static_cast<double>(n);
+        n        = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(repetition / std::max(per, 1e-12)));
+
+        std::vector<double> times;
+        for (int r = 0; r < settings.repetitions; ++r)
+            times.push_back(batch(n) * 1.0e9 / static_cast<double>(n));
+        std::sort(times.begin(), times.end());
+
+        bench_result result{name, n, times[times.size() / 2], times.front(), times.back(), items, label, {}, times};
+        results.push_back(result);
+        if (results.size() == 1)
+        {
+            out << std::left << std::setw(44) << "benchmark" << std::right << std::setw(14) << "ns/op" << std::setw(12)
+                << "min" << std::setw(12) << "max" << std::setw(14) << "iterations" << '\n';
+        }
+        out << std::left << std::setw(44) << name << std::right << std::fixed << std::setprecision(2) << std::setw(14)
+            << result.ns_per_op << std::setw(12) << result.min_ns << std::setw(12) << result.max_ns << std::setw(14) << n;
+        if (items > 0)
+            out << "  " << items * 1.0e3 / result.ns_per_op << " M" << (label.empty() ? "items" : label) << "/s";
+        out << '\n';
+        out.unsetf(std::ios::floatfield);
+    }
+
+    // Keep a result measured some other way, for write_json.
+    void add(const bench_result &result) { results.push_back(result); }
+
+    const std::vector<bench_result> &all() const { return results; }
+
+    // Google Benchmark's JSON layout: a context block describing the machine
+    // and build, and one entry per benchmark with times in nanoseconds.
+    void write_json(std::ostream &json, const std::string &program) const
+    {
+        json << "{\n  \"context\": " << context_json(program) << ",\n  \"benchmarks\": [";
+        for (std::size_t i = 0; i < results.size(); ++i)
+        {
+            const auto &r = results[i];
+            json << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << r.name << "\", \"run_type\": \"aggregate\""
+                 << ", \"aggregate_name\": \"median\", \"repetitions\": " << settings.repetitions
+                 << ", \"iterations\": " << r.iterations << std::setprecision(6) << ", \"real_time\": " << r.ns_per_op
+                 << ", \"cpu_time\": " << r.ns_per_op << ", \"min_time\": " << r.min_ns << ", \"max_time\": " << r.max_ns
+                 << ", \"time_unit\": \"ns\"";
+            if (r.items > 0)
+                json << ", \"items_per_second\": " << r.items * 1.0e9 / r.ns_per_op;
+            if (!r.label.empty())
+                json << ", \"label\": \"" << r.label << "\"";
+            for (const auto &[key, value] : r.counters)
+                json << ", \"" << key << "\": " << value;
+            json << '}';
+        }
+        json << "\n  ]\n}\n";
+    }
+
+    // The machine and build the results came from.
+    static std::string context_json(const std::string &program)
+    {
+        std::ostringstream s;
+        s << "{\"date\": \"" << bench_timestamp() << "\", \"host_name\": \"" << bench_host() << "\", \"executable\": \""
+          << program << "\", \"num_cpus\": " << std::thread::hardware_concurrency() << ", \"cpu_model\": \""
+          << bench_cpu_model() << "\", \"compiler\": \"" << bench_compiler() << "\", \"library_build_type\": \""
+          << bench_build_type() << "\"}";
+        return s.str();
+    }
+
+  private:
+    bench_settings            settings;
+    std::ostream             &out;
+    std::vector<bench_result> results;
+};
+
+#endif
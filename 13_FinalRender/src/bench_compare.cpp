@@ -0,0 +1,314 @@
+#include "bench_history.h"
+#include "options.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Compares two revisions in a benchmark history file and flags the
+// benchmarks that became slower.
+//
+// Each run of a benchmark counts once, with the mean of its repetitions:
+// repetitions within a run share the build, the machine's state and the data,
+// so they are not independent samples.  The difference of the means of the
+// runs at two revisions gets a confidence interval from Welch's t-test, which
+// does not assume both revisions are equally noisy; it takes at least two runs
+// of each revision.  A benchmark is slower when the whole interval lies above
+// zero and the change is larger than the threshold, so noise alone is not
+// reported and neither are real but negligible changes.  Only runs on the same
+// host are set against each other.  The exit status is 2 when something got
+// slower, so a script can stop on it.
+//
+//   bench_compare history.jsonl                  newest revision against the one before
+//   bench_compare --base v1 --head v2 history.jsonl
+
+// Regularized incomplete beta function I_x(a, b), by Lentz's evaluation of
+// its continued fraction.
+static double incomplete_beta(double a, double b, double x)
+{
+    if (x <= 0)
+        return 0;
+    if (x >= 1)
+        return 1;
+    if (x > (a + 1) / (a + b + 2))
+        return 1 - incomplete_beta(b, a, 1 - x);
+
+    const double tiny  = 1.0e-30;
+    double       front =
+        std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) + a * std::log(x) + b * std::log1p(-x)) / a;
+    double f = 1, c = 1, d = 0;
+    for (int i = 0; i <= 300; ++i)
+    {
+        double m = static_cast<double>(i / 2);
+        double numerator;
+        if (i == 0)
+            numerator = 1;
+        else if (i % 2 == 0)
+            numerator = m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+        else
+            numerator = -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+
+        d = 1 + numerator * d;
+        d = 1 / (std::fabs(d) < tiny ? tiny : d);
+        c = 1 + numerator / c;
+        c = std::fabs(c) < tiny ? tiny : c;
+        f *= c * d;
+        if (std::fabs(1 - c * d) < 1.0e-12)
+            break;
+    }
+    return front * (f - 1);
+}
+
+// P(T <= t) for Student's t with df degrees of freedom, t >= 0.
+static double student_t_cdf(double t, double df)
+{
+    return 1 - 0.5 * incomplete_beta(df / 2, 0.5, df / (df + t * t));
+}
+
+// The t with P(T <= t) = p, for p >= 0.5, by bisection.
+static double student_t_quantile(double p, double df)
+{
+    double low = 0, high = 1.0e4;
+    for (int i = 0; i < 200; ++i)
+    {
+        double mid = (low + high) / 2;
+        (student_t_cdf(mid, df) < p ? low : high) = mid;
+    }
+    return (low + high) / 2;
+}
+
+struct sample_stats
+{
+    double mean     = 0;
+    double variance = 0; // of the sample, n - 1 in the denominator
+    int    count    = 0;
+};
+
+static sample_stats describe(const std::vector<double> &values)
+{
+    sample_stats s;
+    s.count = static_cast<int>(values.size());
+    for (double v : values)
+        s.mean += v;
+    s.mean /= std::max(1, s.count);
+    for (double v : values)
+        s.variance += (v - s.mean) * (v - s.mean);
+    s.variance /= std::max(1, s.count - 1);
+    return s;
+}
+
+// The repetitions of each run, by run id.
+using run_times = std::map<std::string, std::vector<double>>;
+
+// The mean time of each run, the samples that are compared.
+static std::vector<double> run_means(const run_times &runs)
+{
+    std::vector<double> means;
+    for (const auto &run : runs)
+        means.push_back(describe(run.second).mean);
+    return means;
+}
+
+struct comparison
+{
+    double change = 0; // head over base, minus 1
+    double low    = 0; // the confidence interval of change
+    double high   = 0;
+};
+
+// Welch's interval for the difference of the means, relative to the base.
+static comparison compare_means(const sample_stats &base, const sample_stats &head, double confidence)
+{
+    double vb = base.variance / base.count;
+    double vh = head.variance / head.count;
+    double se = std::sqrt(vb + vh);
+    double df = vb + vh > 0 ? (vb + vh) * (vb + vh) /
+                                  (vb * vb / (base.count - 1) + vh * vh / (head.count - 1))
+                            : 1.0;
+    double margin = se > 0 ? student_t_quantile(1 - (1 - confidence) / 2, df) * se : 0.0;
+    double diff   = head.mean - base.mean;
+    return {diff / base.mean, (diff - margin) / base.mean, (diff + margin) / base.mean};
+}
+
+static void print_compare_usage(std::ostream &out, const char *program)
+{
+    out << "Usage: " << program << " [options] history.jsonl\n"
+        << "\n"
+        << "  --base rev           revision to compare against (default: the one\n"
+        << "                       before the newest)\n"
+        << "  --head rev           revision to check (default: the newest)\n"
+        << "  --filter text        compare only benchmarks whose names contain text\n"
+        << "  --confidence c       confidence of the intervals (default 0.95)\n"
+        << "  --threshold pct      smallest change reported, in percent (default 2)\n"
+        << "  --help               show this message\n";
+}
+
+int main(int argc, char **argv)
+{
+    std::string base_revision, head_revision, filter, path;
+    double      confidence = 0.95;
+    double      threshold  = 2;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            print_compare_usage(std::cout, argv[0]);
+            return 0;
+        }
+        if (arg.rfind("--", 0) != 0)
+        {
+            path = arg;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << arg << '\n';
+            print_compare_usage(std::cerr, argv[0]);
+            return 1;
+        }
+        std::string value = argv[++i];
+        bool        good  = true;
+        if (arg == "--base")
+            base_revision = value;
+        else if (arg == "--head")
+            head_revision = value;
+        else if (arg == "--filter")
+            filter = value;
+        else if (arg == "--confidence")
+            good = parse_double(value, confidence) && confidence > 0 && confidence < 1;
+        else if (arg == "--threshold")
+            good = parse_double(value, threshold) && threshold >= 0;
+        else
+        {
+            std::cerr << "Unknown option " << arg << '\n';
+            print_compare_usage(std::cerr, argv[0]);
+            return 1;
+        }
+        if (!good)
+        {
+            std::cerr << "Bad " << arg << " value '" << value << "'\n";
+            return 1;
+        }
+    }
+    if (path.empty())
+    {
+        print_compare_usage(std::cerr, argv[0]);
+        return 1;
+    }
+
+    std::vector<history_record> records;
+    if (!read_history(path, records, std::cerr))
+        return 1;
+
+    // Revisions in the order they were last run, so the newest is last.
+    std::vector<std::string> revisions;
+    for (const auto &r : records)
+    {
+        revisions.erase(std::remove(revisions.begin(), revisions.end(), r.revision), revisions.end());
+        revisions.push_back(r.revision);
+    }
+    if (head_revision.empty() && !revisions.empty())
+        head_revision = revisions.back();
+    if (base_revision.empty())
+    {
+        auto head = std::find(revisions.begin(), revisions.end(), head_revision);
+        if (head != revisions.begin() && head != revisions.end())
+            base_revision = *(head - 1);
+    }
+    if (base_revision.empty() || base_revision == head_revision)
+    {
+        std::cerr << "Need two revisions to compare; " << path << " has " << revisions.size() << ".\n";
+        return 1;
+    }
+
+    // The runs of every benchmark per host, in the order the head ran them.
+    // Lines written before runs had ids are told apart by date and program.
+    using key = std::pair<std::string, std::string>;
+    std::vector<key>                               order;
+    std::map<key, std::pair<run_times, run_times>> times;
+    for (const auto &r : records)
+    {
+        bool is_base = r.revision == base_revision;
+        if ((!is_base && r.revision != head_revision) ||
+            (!filter.empty() && r.name.find(filter) == std::string::npos))
+            continue;
+        key   k{r.name, r.host};
+        auto &revision_runs = is_base ? times[k].first : times[k].second;
+        if (!is_base && revision_runs.empty())
+            order.push_back(k);
+        auto &run = revision_runs[r.run.empty() ? r.date + ' ' + r.program : r.run];
+        run.insert(run.end(), r.times.begin(), r.times.end());
+    }
+
+    std::cout << "Comparing " << head_revision << " against " << base_revision << ", " << confidence * 100
+              << "% intervals:\n";
+    std::cout << std::left << std::setw(48) << "benchmark" << std::right << std::setw(14) << "base ns" << std::setw(14)
+              << "head ns" << std::setw(9) << "change" << std::setw(22) << "interval" << std::setw(8) << "runs"
+              << '\n';
+
+    int slower = 0, faster = 0, same = 0, unmeasured = 0;
+    for (const auto &k : order)
+    {
+        const auto &[base_runs, head_runs] = times[k];
+        if (base_runs.empty())
+            continue;
+        auto base = describe(run_means(base_runs));
+        auto head = describe(run_means(head_runs));
+
+        std::string name = k.first;
+        if (k.second != records.back().host)
+            name += " @" + k.second;
+        auto runs = std::to_string(base.count) + '/' + std::to_string(head.count);
+
+        std::string        verdict;
+        std::ostringstream interval;
+        interval << std::fixed << std::setprecision(1) << std::showpos;
+        double change = head.mean / base.mean - 1;
+        if (base.count < 2 || head.count < 2)
+        {
+            ++unmeasured;
+            interval << "-";
+            verdict = "too few runs";
+        }
+        else
+        {
+            auto c = compare_means(base, head, confidence);
+            change = c.change;
+            interval << '[' << 100 * c.low << "%, " << 100 * c.high << "%]";
+            if (c.low > 0 && 100 * c.change > threshold)
+            {
+                ++slower;
+                verdict = "SLOWER";
+            }
+            else if (c.high < 0 && -100 * c.change > threshold)
+            {
+                ++faster;
+                verdict = "faster";
+            }
+            else
+                ++same;
+        }
+
+        std::cout << std::left << std::setw(48) << name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(14) << base.mean << std::setw(14) << head.mean << std::showpos << std::setw(8)
+                  << 100 * change << '%' << std::noshowpos << std::setw(22) << interval.str() << std::setw(8) << runs;
+        if (!verdict.empty())
+            std::cout << "  " << verdict;
+        std::cout << '\n';
+    }
+    std::cout.unsetf(std::ios::floatfield);
+
+    std::cout << slower << " slower, " << faster << " faster, " << same << " unchanged";
+    if (unmeasured != 0)
+        std::cout << ", " << unmeasured << " with too few runs to tell";
+    std::cout << ".\n";
+    return slower != 0 ? 2 : 0;
+}
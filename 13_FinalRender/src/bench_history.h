@@ -0,0 +1,296 @@
+#ifndef BENCH_HISTORY_H
+#define BENCH_HISTORY_H
+
+#include "bench.h"
+#include "raytrace_config.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A local history of benchmark results that runs append to, for
+// bench_compare to find regressions between revisions.  It is JSON lines:
+// one object per benchmark per run, holding the build's git revision and
+// compiler flags, the machine, an id shared by the lines of one run, the
+// nanoseconds of every repetition and the benchmark's counters, such as
+// samples per second.
+//
+//   raytrace_bench --history history.jsonl > /dev/null
+//   bench_compare history.jsonl
+
+struct history_record
+{
+    std::string                                 revision;
+    std::string                                 date;
+    std::string                                 run;      // the date and the writer's process id
+    std::string                                 host;
+    std::string                                 cpu;
+    std::string                                 compiler;
+    std::string                                 flags;
+    std::string                                 program;
+    std::string                                 name;
+    std::vector<double>                         times;    // nanoseconds per repetition
+    std::vector<std::pair<std::string, double>> counters;
+};
+
+inline std::string json_quote(const std::string &text)
+{
+    std::string quoted = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            quoted += '\\';
+        if (static_cast<unsigned char>(c) >= 0x20)
+            quoted += c;
+    }
+    return quoted + '"';
+}
+
+// Tells apart runs that start in the same second.
+inline std::string history_run_id(const std::string &date)
+{
+#if RT_HAVE_UNISTD
+    return date + '/' + std::to_string(::getpid());
+#else
+    return date + '/' + std::to_string(std::random_device{}());
+#endif
+}
+
+// Append a line per result to the history at path.  Returns false, after
+// reporting the problem on err, if it cannot be written.
+inline bool append_history(const std::string &path, const std::string &program, const std::vector<bench_result> &results,
+                           std::ostream &err)
+{
+    std::ofstream out(path, std::ios::app);
+    if (!out)
+    {
+        err << "Could not open history file " << path << '\n';
+        return false;
+    }
+
+    auto date = bench_timestamp();
+    auto run  = history_run_id(date);
+    for (const auto &r : results)
+    {
+        std::ostringstream line;
+        line << std::setprecision(9) << "{\"revision\": " << json_quote(RAYTRACE_GIT_REVISION)
+             << ", \"date\": " << json_quote(date) << ", \"run\": " << json_quote(run) << ", \"host\": " << json_quote(bench_host())
+             << ", \"cpu\": " << json_quote(bench_cpu_model()) << ", \"compiler\": " << json_quote(bench_compiler())
+             << ", \"flags\": " << json_quote(RAYTRACE_CXX_FLAGS) << ", \"program\": " << json_quote(program)
+             << ", \"name\": " << json_quote(r.name) << ", \"times\": [";
+        if (r.times.empty())
+            line << r.ns_per_op;
+        for (std::size_t i = 0; i < r.times.size(); ++i)
+            line << (i == 0 ? "" : ", ") << r.times[i];
+        line << "], \"counters\": {";
+        for (std::size_t i = 0; i < r.counters.size(); ++i)
+            line << (i == 0 ? "" : ", ") << json_quote(r.counters[i].first) << ": " << r.counters[i].second;
+        line << "}}\n";
+        out << line.str();
+    }
+    out.close();
+    if (!out)
+    {
+        err << "Could not write history file " << path << '\n';
+        return false;
+    }
+    return true;
+}
+
+// Reads one line of history.  Only what append_history writes is needed, but
+// any JSON value under an unknown key is skipped, so fields can be added.
+class history_parser
+{
+  public:
+    explicit history_parser(const std::string &line) : text{line} {}
+
+    bool parse(history_record &r)
+    {
+        if (!accept('{'))
+            return false;
+        if (peek() == '}')
+            return accept('}') && end();
+        do
+        {
+            std::string key;
+            if (!quoted(key) || !accept(':'))
+                return false;
+            bool good = true;
+            if (key == "revision")
+                good = quoted(r.revision);
+            else if (key == "date")
+                good = quoted(r.date);
+            else if (key == "run")
+                good = quoted(r.run);
+            else if (key == "host")
+                good = quoted(r.host);
+            else if (key == "cpu")
+                good = quoted(r.cpu);
+            else if (key == "compiler")
+                good = quoted(r.compiler);
+            else if (key == "flags")
+                good = quoted(r.flags);
+            else if (key == "program")
+                good = quoted(r.program);
+            else if (key == "name")
+                good = quoted(r.name);
+            else if (key == "times")
+                good = numbers(r.times);
+            else if (key == "counters")
+                good = counters(r.counters);
+            else
+                good = skip();
+            if (!good)
+                return false;
+        } while (accept(','));
+        return accept('}') && end();
+    }
+
+  private:
+    char peek()
+    {
+        while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+            ++pos;
+        return pos < text.size() ? text[pos] : '\0';
+    }
+
+    bool accept(char c)
+    {
+        if (peek() != c)
+            return false;
+        ++pos;
+        return true;
+    }
+
+    bool end() { return peek() == '\0'; }
+
+    bool quoted(std::string &value)
+    {
+        if (!accept('"'))
+            return false;
+        value.clear();
+        while (pos < text.size() && text[pos] != '"')
+        {
+            if (text[pos] == '\\' && pos + 1 < text.size())
+                ++pos;
+            value += text[pos++];
+        }
+        return pos++ < text.size();
+    }
+
+    bool number(double &value)
+    {
+        peek();
+        const char *start = text.c_str() + pos;
+        char       *stop  = nullptr;
+        value             = std::strtod(start, &stop);
+        pos += static_cast<std::size_t>(stop - start);
+        return stop != start;
+    }
+
+    bool numbers(std::vector<double> &values)
+    {
+        values.clear();
+        if (!accept('['))
+            return false;
+        if (accept(']'))
+            return true;
+        do
+        {
+            double v = 0;
+            if (!number(v))
+                return false;
+            values.push_back(v);
+        } while (accept(','));
+        return accept(']');
+    }
+
+    bool counters(std::vector<std::pair<std::string, double>> &values)
+    {
+        values.clear();
+        if (!accept('{'))
+            return false;
+        if (accept('}'))
+            return true;
+        do
+        {
+            std::string key;
+            double      v = 0;
+            if (!quoted(key) || !accept(':') || !number(v))
+                return false;
+            values.emplace_back(key, v);
+        } while (accept(','));
+        return accept('}');
+    }
+
+    bool skip()
+    {
+        std::string ignored;
+        double      number_ignored = 0;
+        char        c              = peek();
+        if (c == '"')
+            return quoted(ignored);
+        if (c == '[' || c == '{')
+        {
+            char close = c == '[' ? ']' : '}';
+            ++pos;
+            if (accept(close))
+                return true;
+            do
+            {
+                if (close == '}' && (!quoted(ignored) || !accept(':')))
+                    return false;
+                if (!skip())
+                    return false;
+            } while (accept(','));
+            return accept(close);
+        }
+        for (const char *word : {"true", "false", "null"})
+        {
+            if (text.compare(pos, std::string(word).size(), word) == 0)
+            {
+                pos += std::string(word).size();
+                return true;
+            }
+        }
+        return number(number_ignored);
+    }
+
+    const std::string &text;
+    std::size_t        pos = 0;
+};
+
+// Every record in the history at path, oldest first.  Returns false, after
+// reporting the problem on err, if it cannot be read.
+inline bool read_history(const std::string &path, std::vector<history_record> &records, std::ostream &err)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        err << "Could not open history file " << path << '\n';
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(in, line); ++number)
+    {
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+        history_record r;
+        if (!history_parser(line).parse(r) || r.name.empty() || r.times.empty())
+        {
+            err << path << ':' << number << ": not a benchmark history record\n";
+            return false;
+        }
+        records.push_back(std::move(r));
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef BENCH_SCENES_H
+#define BENCH_SCENES_H
+
+#include "binary_scene.h"
+#include "options.h"
+#include "random_scene.h"
+#include "rtweekend.h"
+#include "scene_generator.h"
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The fixed scenes the end-to-end benchmarks render, and the parsing of
+// their shared options.
+
+struct workload
+{
+    std::string                   name;
+    std::unique_ptr<loaded_scene> scene;
+};
+
+// "random:seed" is the built-in scene drawn after seed_random(seed), with
+// plain "random" the one the renderer draws from a freshly seeded generator,
+// whatever was drawn before; "generated:n" is a field of n spheres.
+inline bool make_workload(const std::string &spec, workload &w, std::ostream &err)
+{
+    auto colon = spec.find(':');
+    auto kind  = spec.substr(0, colon);
+    auto value = colon == std::string::npos ? std::string() : spec.substr(colon + 1);
+
+    w.name  = spec;
+    w.scene = std::make_unique<loaded_scene>();
+    if (kind == "random")
+    {
+        int seed = 0;
+        if (!value.empty() && (!parse_int(value, seed) || seed < 0))
+        {
+            err << "Bad scene seed in '" << spec << "'\n";
+            return false;
+        }
+        if (!value.empty())
+            seed_random(static_cast<std::uint64_t>(seed));
+        else
+            random_generator().seed();
+        w.scene->description = random_scene();
+    }
+    else if (kind == "generated")
+    {
+        int count = 0;
+        if (!parse_int(value, count) || count <= 0)
+        {
+            err << "Bad sphere count in '" << spec << "'\n";
+            return false;
+        }
+        generator_settings g;
+        g.spheres = static_cast<std::size_t>(count);
+        generate_scene(g, w.scene->description, static_cast<int>(std::max(1u, std::thread::hardware_concurrency())));
+    }
+    else
+    {
+        err << "Unknown scene '" << spec << "', expected random, random:seed or generated:n\n";
+        return false;
+    }
+    index_scene(*w.scene, {}, err);
+    return true;
+}
+
+inline bool parse_size_pair(const std::string &text, int &width, int &height)
+{
+    auto x = text.find('x');
+    return x != std::string::npos && parse_int(text.substr(0, x), width) && parse_int(text.substr(x + 1), height) &&
+           width > 1 && height > 1;
+}
+
+inline bool parse_int_list(const std::string &text, std::vector<int> &values)
+{
+    values.clear();
+    for (const auto &field : split_list(text))
+    {
+        int v = 0;
+        if (!parse_int(field, v) || v <= 0)
+            return false;
+        values.push_back(v);
+    }
+    return !values.empty();
+}
+
+#endif
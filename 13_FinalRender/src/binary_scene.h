@@ -0,0 +1,303 @@
+#ifndef BINARY_SCENE_H
+#define BINARY_SCENE_H
+
+#include "bvh.h"
+#include "bvh_cache.h"
+#include "flat_scene.h"
+#include "scene_file.h"
+
+#include <bit>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <span>
+#include <string>
+#include <vector>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define RT_HAVE_MMAP 1
+#else
+#define RT_HAVE_MMAP 0
+#endif
+
+// Binary scene files: the flat arrays of flat_scene.h and their prebuilt
+// BVH, laid out so the file can be mapped read-only and rendered from in
+// place.
+//
+// The file is a header followed by the sphere, material and node arrays,
+// each starting on a 64-byte boundary.  Sections are located by offsets from
+// the start of the file and records refer to each other by index, so the
+// file means the same wherever it is mapped.  Opening one checks the header
+// and maps the file; nothing is parsed or copied, and the pages are read in
+// as rays first touch them.  Processes rendering the same file share its
+// pages through the page cache.  Values are little-endian.
+//
+// Write one from a text scene with scene_compile.
+
+struct binary_scene_header
+{
+    char          magic[8];
+    std::uint32_t version;
+    std::uint32_t header_bytes;
+    std::uint64_t file_bytes;
+    double        lookfrom[3];
+    double        lookat[3];
+    double        vup[3];
+    double        vfov;
+    double        aperture;
+    double        focus_dist;
+    std::int32_t  image_width;
+    std::int32_t  image_height;
+    std::int32_t  samples_per_pixel;
+    std::int32_t  max_depth;
+    std::uint64_t sphere_count;
+    std::uint64_t sphere_offset;
+    std::uint64_t material_count;
+    std::uint64_t material_offset;
+    std::uint64_t node_count;
+    std::uint64_t node_offset;
+};
+
+const char          binary_scene_magic[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+const std::uint32_t binary_scene_version  = 1;
+
+inline bool is_binary_scene(const std::string &path)
+{
+    char          magic[8] = {};
+    std::ifstream in(path, std::ios::binary);
+    in.read(magic, sizeof(magic));
+    return in && std::memcmp(magic, binary_scene_magic, sizeof(magic)) == 0;
+}
+
+// Write s, whose spheres must be in the order nodes expects, to path.
+// Returns false, after reporting the problem on err, if the file cannot be
+// written.
+inline bool write_binary_scene(const std::string &path, const scene &s, const std::vector<bvh_node> &nodes,
+                               std::ostream &err)
+{
+    if constexpr (std::endian::native != std::endian::little)
+    {
+        err << "Binary scenes can only be written on little-endian machines\n";
+        return false;
+    }
+
+    auto align = [](std::uint64_t offset) { return (offset + 63) / 64 * 64; };
+
+    binary_scene_header h{};
+    std::memcpy(h.magic, binary_scene_magic, sizeof(h.magic));
+    h.version      = binary_scene_version;
+    h.header_bytes = sizeof(h);
+    for (int a = 0; a < 3; ++a)
+    {
+        h.lookfrom[a] = s.camera.lookfrom[a];
+        h.lookat[a]   = s.camera.lookat[a];
+        h.vup[a]      = s.camera.vup[a];
+    }
+    h.vfov              = s.camera.vfov;
+    h.aperture          = s.camera.aperture;
+    h.focus_dist        = s.camera.focus_dist;
+    h.image_width       = s.image_width;
+    h.image_height      = s.image_height;
+    h.samples_per_pixel = s.samples_per_pixel;
+    h.max_depth         = s.max_depth;
+    h.sphere_count      = s.spheres.size();
+    h.sphere_offset     = align(sizeof(h));
+    h.material_count    = s.materials.size();
+    h.material_offset   = align(h.sphere_offset + h.sphere_count * sizeof(sphere_record));
+    h.node_count        = nodes.size();
+    h.node_offset       = align(h.material_offset + h.material_count * sizeof(material_record));
+    h.file_bytes        = h.node_offset + h.node_count * sizeof(bvh_node);
+
+    std::ofstream out(path, std::ios::binary);
+    auto          section = [&](std::uint64_t offset, const void *data, std::uint64_t bytes)
+    {
+        static const char zeros[64] = {};
+        out.write(zeros, static_cast<std::streamsize>(offset - static_cast<std::uint64_t>(out.tellp())));
+        out.write(static_cast<const char *>(data), static_cast<std::streamsize>(bytes));
+    };
+    out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    section(h.sphere_offset, s.spheres.data(), h.sphere_count * sizeof(sphere_record));
+    section(h.material_offset, s.materials.data(), h.material_count * sizeof(material_record));
+    section(h.node_offset, nodes.data(), h.node_count * sizeof(bvh_node));
+    out.close();
+
+    if (!out)
+    {
+        err << "Could not write " << path << '\n';
+        return false;
+    }
+    return true;
+}
+
+// A binary scene file mapped read-only.
+class mapped_scene
+{
+  public:
+    mapped_scene() {}
+    mapped_scene(const mapped_scene &)            = delete;
+    mapped_scene &operator=(const mapped_scene &) = delete;
+    ~mapped_scene() { close(); }
+
+    // Map path and check its header.  Returns false and reports on err if
+    // the file cannot be mapped or is not a scene this program can read.
+    // The arrays themselves are trusted, so opening touches only the
+    // header's page.
+    bool open(const std::string &path, std::ostream &err)
+    {
+#if RT_HAVE_MMAP
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return fail("open", path, err);
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+            return fail("fstat", path, err);
+        bytes = static_cast<std::size_t>(st.st_size);
+        if (bytes < sizeof(binary_scene_header))
+            return bad(path, "it is too short", err);
+
+        void *addr = ::mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED)
+            return fail("mmap", path, err);
+        base = static_cast<const std::uint8_t *>(addr);
+#else
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in)
+            return bad(path, "it cannot be opened", err);
+        bytes = static_cast<std::size_t>(in.tellg());
+        copy.resize((bytes + 7) / 8);
+        in.seekg(0);
+        in.read(reinterpret_cast<char *>(copy.data()), static_cast<std::streamsize>(bytes));
+        if (!in || bytes < sizeof(binary_scene_header))
+            return bad(path, "it cannot be read", err);
+        base = reinterpret_cast<const std::uint8_t *>(copy.data());
+#endif
+
+        const auto &h = header();
+        if (std::memcmp(h.magic, binary_scene_magic, sizeof(h.magic)) != 0)
+            return bad(path, "it is not a binary scene", err);
+        if (std::endian::native != std::endian::little)
+            return bad(path, "binary scenes are little-endian", err);
+        if (h.version != binary_scene_version || h.header_bytes != sizeof(binary_scene_header))
+            return bad(path, "it was written by an incompatible version", err);
+        if (h.file_bytes != bytes || !section_fits(h.sphere_offset, h.sphere_count, sizeof(sphere_record)) ||
+            !section_fits(h.material_offset, h.material_count, sizeof(material_record)) ||
+            !section_fits(h.node_offset, h.node_count, sizeof(bvh_node)) || (h.sphere_count > 0 && h.node_count == 0))
+            return bad(path, "it is truncated or damaged", err);
+        return true;
+    }
+
+    void close()
+    {
+#if RT_HAVE_MMAP
+        if (base != nullptr)
+            ::munmap(const_cast<std::uint8_t *>(base), bytes);
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+#endif
+        base = nullptr;
+    }
+
+    bool is_open() const { return base != nullptr; }
+
+    const binary_scene_header &header() const { return *reinterpret_cast<const binary_scene_header *>(base); }
+
+    std::span<const sphere_record> spheres() const
+    {
+        return {reinterpret_cast<const sphere_record *>(base + header().sphere_offset), header().sphere_count};
+    }
+
+    std::span<const material_record> materials() const
+    {
+        return {reinterpret_cast<const material_record *>(base + header().material_offset), header().material_count};
+    }
+
+    std::span<const bvh_node> nodes() const
+    {
+        return {reinterpret_cast<const bvh_node *>(base + header().node_offset), header().node_count};
+    }
+
+  private:
+    bool section_fits(std::uint64_t offset, std::uint64_t count, std::uint64_t record) const
+    {
+        return offset % 8 == 0 && offset <= bytes && count <= (bytes - offset) / record;
+    }
+
+    bool fail(const char *what, const std::string &path, std::ostream &err)
+    {
+        err << "Cannot map " << path << ": " << what << " failed: " << std::strerror(errno) << '\n';
+        close();
+        return false;
+    }
+
+    bool bad(const std::string &path, const char *why, std::ostream &err)
+    {
+        err << "Cannot load " << path << ": " << why << '\n';
+        close();
+        return false;
+    }
+
+    const std::uint8_t *base  = nullptr;
+    std::size_t         bytes = 0;
+#if RT_HAVE_MMAP
+    int fd = -1;
+#else
+    std::vector<std::uint64_t> copy;
+#endif
+};
+
+// A scene ready to render, built in or read from either kind of file.  Text
+// and built-in scenes keep their arrays in description and get their BVH
+// from index_scene; binary scenes are used from the mapping.  world views
+// whichever holds them.
+struct loaded_scene
+{
+    scene                 description;
+    std::vector<bvh_node> nodes;
+    mapped_scene          mapping;
+    flat_scene            world;
+};
+
+// Give the spheres in s.description their BVH, from the cache in cache_dir
+// unless that is empty, and point s.world at them.
+inline void index_scene(loaded_scene &s, const std::string &cache_dir, std::ostream &log)
+{
+    auto &d = s.description;
+    s.nodes = cache_dir.empty() ? build_bvh(d.spheres) : cached_bvh(d.spheres, cache_dir, log);
+    s.world = flat_scene(d.spheres, d.materials, s.nodes);
+}
+
+// Returns false, after reporting the problem on err, if path cannot be
+// loaded.  A binary scene is ready to render; a text scene is left in
+// s.description for index_scene.
+inline bool load_scene(const std::string &path, loaded_scene &s, std::ostream &err)
+{
+    if (!is_binary_scene(path))
+        return read_text_scene(path, s.description, err);
+
+    if (!s.mapping.open(path, err))
+        return false;
+
+    const auto &h = s.mapping.header();
+    auto       &d = s.description;
+    d.camera.lookfrom   = point3(h.lookfrom[0], h.lookfrom[1], h.lookfrom[2]);
+    d.camera.lookat     = point3(h.lookat[0], h.lookat[1], h.lookat[2]);
+    d.camera.vup        = vec3(h.vup[0], h.vup[1], h.vup[2]);
+    d.camera.vfov       = h.vfov;
+    d.camera.aperture   = h.aperture;
+    d.camera.focus_dist = h.focus_dist;
+    d.image_width       = h.image_width;
+    d.image_height      = h.image_height;
+    d.samples_per_pixel = h.samples_per_pixel;
+    d.max_depth         = h.max_depth;
+    s.world             = flat_scene(s.mapping.spheres(), s.mapping.materials(), s.mapping.nodes());
+    return true;
+}
+
+#endif
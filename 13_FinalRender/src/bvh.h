@@ -0,0 +1,245 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "flat_scene.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Builds the bounding volume hierarchy of a flat scene.
+//
+// Each node is split where the surface area heuristic says rays will test
+// the fewest spheres, choosing among a fixed number of bins along the widest
+// axis of the sphere centres, which keeps the build O(n log n) even for tens
+// of millions of spheres.  Spheres are reordered so every leaf covers a
+// contiguous run of them.
+//
+// The builder works on copies of the spheres' bounds tagged with their
+// original index, so the order it settles on can be recorded and applied
+// again later without building (bvh_cache.h).
+
+struct bvh_box
+{
+    double lower[3] = {std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(),
+                       std::numeric_limits<double>::infinity()};
+    double upper[3] = {-std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(),
+                       -std::numeric_limits<double>::infinity()};
+
+    void grow(const double lo[3], const double hi[3])
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            lower[a] = std::min(lower[a], lo[a]);
+            upper[a] = std::max(upper[a], hi[a]);
+        }
+    }
+
+    void grow(const bvh_box &b) { grow(b.lower, b.upper); }
+
+    double area() const
+    {
+        if (lower[0] > upper[0])
+            return 0.0;
+        double dx = upper[0] - lower[0];
+        double dy = upper[1] - lower[1];
+        double dz = upper[2] - lower[2];
+        return 2.0 * (dx * dy + dy * dz + dz * dx);
+    }
+};
+
+// A sphere's centre and radius, and where it was in the scene.
+struct bvh_item
+{
+    double        center[3];
+    double        radius;
+    std::uint32_t index;
+};
+
+template <typename S>
+bvh_box sphere_box(const S &s)
+{
+    bvh_box b;
+    for (int a = 0; a < 3; ++a)
+    {
+        b.lower[a] = s.center[a] - s.radius;
+        b.upper[a] = s.center[a] + s.radius;
+    }
+    return b;
+}
+
+class bvh_builder
+{
+  public:
+    bvh_builder(std::vector<bvh_item> &s, std::vector<bvh_node> &n) : spheres{s}, nodes{n} {}
+
+    void build(std::uint32_t first, std::uint32_t count, int depth)
+    {
+        auto index = static_cast<std::uint32_t>(nodes.size());
+        nodes.emplace_back();
+
+        bvh_box bounds;
+        bvh_box centres;
+        for (auto i = first; i < first + count; ++i)
+        {
+            bounds.grow(sphere_box(spheres[i]));
+            centres.grow(spheres[i].center, spheres[i].center);
+        }
+        store_bounds(nodes[index], bounds);
+
+        int axis = 0;
+        for (int a = 1; a < 3; ++a)
+        {
+            if (centres.upper[a] - centres.lower[a] > centres.upper[axis] - centres.lower[axis])
+                axis = a;
+        }
+        double extent = centres.upper[axis] - centres.lower[axis];
+
+        std::uint32_t left_count = 0;
+        if (count > max_leaf && extent > 0)
+            left_count = depth < sah_depth ? sah_split(first, count, axis, centres.lower[axis], extent, bounds)
+                                           : median_split(first, count, axis);
+
+        if (left_count == 0)
+        {
+            nodes[index].offset = first;
+            nodes[index].count  = count;
+            return;
+        }
+
+        build(first, left_count, depth + 1);
+        nodes[index].offset = static_cast<std::uint32_t>(nodes.size());
+        nodes[index].count  = 0;
+        build(first + left_count, count - left_count, depth + 1);
+    }
+
+  private:
+    static constexpr std::uint32_t max_leaf  = 4;
+    static constexpr int           bin_count = 16;
+
+    // Past this depth nodes are split at the median, which halves the count
+    // every level and so bounds the depth the traversal stack must hold.
+    static constexpr int sah_depth = 28;
+
+    // Floats rounded outwards so the node still encloses its spheres.
+    static void store_bounds(bvh_node &n, const bvh_box &b)
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            n.lower[a] = std::nextafter(static_cast<float>(b.lower[a]), -std::numeric_limits<float>::infinity());
+            n.upper[a] = std::nextafter(static_cast<float>(b.upper[a]), std::numeric_limits<float>::infinity());
+        }
+    }
+
+    int bin_of(const bvh_item &s, int axis, double start, double extent) const
+    {
+        auto b = static_cast<int>(bin_count * (s.center[axis] - start) / extent);
+        return std::min(b, bin_count - 1);
+    }
+
+    // Returns the number of spheres moved to the left child, or 0 if no split
+    // beats a leaf.
+    std::uint32_t sah_split(std::uint32_t first, std::uint32_t count, int axis, double start, double extent,
+                            const bvh_box &bounds)
+    {
+        std::array<bvh_box, bin_count>       bins;
+        std::array<std::uint32_t, bin_count> counts{};
+        for (auto i = first; i < first + count; ++i)
+        {
+            int b = bin_of(spheres[i], axis, start, extent);
+            bins[b].grow(sphere_box(spheres[i]));
+            ++counts[b];
+        }
+
+        // Cost of splitting after bin k, from sweeps in both directions.
+        std::array<double, bin_count> left_cost{};
+        bvh_box                       left_box;
+        std::uint32_t                 left = 0;
+        for (int k = 0; k < bin_count - 1; ++k)
+        {
+            left_box.grow(bins[k]);
+            left += counts[k];
+            left_cost[k] = left_box.area() * left;
+        }
+
+        bvh_box       right_box;
+        std::uint32_t right    = 0;
+        double        best     = std::numeric_limits<double>::infinity();
+        int           best_bin = -1;
+        for (int k = bin_count - 1; k > 0; --k)
+        {
+            right_box.grow(bins[k]);
+            right += counts[k];
+            double cost = left_cost[k - 1] + right_box.area() * right;
+            if (right > 0 && right < count && cost < best)
+            {
+                best     = cost;
+                best_bin = k - 1;
+            }
+        }
+
+        // A leaf costs one test per sphere for every ray that reaches it.
+        if (best_bin < 0 || (count <= 16 && best >= bounds.area() * count))
+            return 0;
+
+        auto middle = std::partition(spheres.begin() + first, spheres.begin() + first + count,
+                                     [&](const bvh_item &s) { return bin_of(s, axis, start, extent) <= best_bin; });
+        return static_cast<std::uint32_t>(middle - (spheres.begin() + first));
+    }
+
+    std::uint32_t median_split(std::uint32_t first, std::uint32_t count, int axis)
+    {
+        auto begin = spheres.begin() + first;
+        std::nth_element(begin, begin + count / 2, begin + count,
+                         [axis](const bvh_item &a, const bvh_item &b) { return a.center[axis] < b.center[axis]; });
+        return count / 2;
+    }
+
+    std::vector<bvh_item> &spheres;
+    std::vector<bvh_node> &nodes;
+};
+
+// Put spheres in the given order: order[i] is the index of the sphere that
+// goes in place i.
+inline void reorder_spheres(std::vector<sphere_record> &spheres, const std::vector<std::uint32_t> &order)
+{
+    std::vector<sphere_record> reordered(spheres.size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+        reordered[i] = spheres[order[i]];
+    spheres.swap(reordered);
+}
+
+// Build the hierarchy over spheres, reordering them.  Node 0 is the root; an
+// empty scene gets no nodes.  If order is given it receives the order applied,
+// as for reorder_spheres.
+inline std::vector<bvh_node> build_bvh(std::vector<sphere_record> &spheres, std::vector<std::uint32_t> *order = nullptr)
+{
+    std::vector<bvh_node> nodes;
+    if (spheres.empty())
+        return nodes;
+
+    std::vector<bvh_item> items(spheres.size());
+    for (std::size_t i = 0; i < spheres.size(); ++i)
+    {
+        const auto &s = spheres[i];
+        items[i]      = {{s.center[0], s.center[1], s.center[2]}, s.radius, static_cast<std::uint32_t>(i)};
+    }
+
+    nodes.reserve(spheres.size() / 2 + 1);
+    bvh_builder b(items, nodes);
+    b.build(0, static_cast<std::uint32_t>(items.size()), 0);
+
+    std::vector<std::uint32_t> applied(items.size());
+    for (std::size_t i = 0; i < items.size(); ++i)
+        applied[i] = items[i].index;
+    reorder_spheres(spheres, applied);
+    if (order != nullptr)
+        order->swap(applied);
+    return nodes;
+}
+
+#endif
@@ -0,0 +1,299 @@
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include "bvh.h"
+#include "flat_scene.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+// An on-disk cache of built BVHs, so a scene that has not changed is not
+// indexed again when only the camera, image size or sample count has.
+//
+// Entries are named after a hash of the scene's sphere records, taken in the
+// order the scene gives them, and hold the order build_bvh put the spheres in
+// and the nodes it built over that order.  A hit costs a hash and a check of
+// the tree against the spheres, both linear, instead of a build.  Anything
+// wrong with an entry - a different builder version, a hash collision, a
+// damaged file - is reported and the BVH built and cached again.
+
+struct bvh_cache_header
+{
+    char          magic[8];
+    std::uint32_t version;
+    std::uint32_t header_bytes;
+    std::uint64_t scene_hash;
+    std::uint64_t sphere_count;
+    std::uint64_t node_count;
+    double        build_ms;
+};
+
+const char bvh_cache_magic[8] = {'R', 'T', 'B', 'V', 'H', '\0', '\0', '\0'};
+
+// Change this whenever build_bvh would build a different tree, so entries
+// from older builds are rebuilt instead of used.
+const std::uint32_t bvh_cache_version = 1;
+
+// Hash of the sphere records, padding included; every reader zeroes it.
+// Four independent multiply-xorshift lanes keep the hash running at memory
+// speed on scenes of millions of spheres.  It only names and checks entries,
+// and a collision is caught when the tree is checked, so it need not be
+// cryptographic.
+inline std::uint64_t hash_spheres(std::span<const sphere_record> spheres)
+{
+    const std::uint64_t multiplier = 0x9e3779b97f4a7c15ULL;
+    auto finish = [](std::uint64_t z)
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    };
+
+    auto          bytes    = std::as_bytes(spheres);
+    std::size_t   words    = bytes.size() / sizeof(std::uint64_t);
+    std::uint64_t lanes[4] = {1, 2, 3, 4};
+    auto          step     = [&](int lane, std::size_t word)
+    {
+        std::uint64_t w;
+        std::memcpy(&w, bytes.data() + word * sizeof(w), sizeof(w));
+        lanes[lane] = (lanes[lane] ^ w) * multiplier;
+        lanes[lane] ^= lanes[lane] >> 32;
+    };
+
+    std::size_t i = 0;
+    for (; i + 4 <= words; i += 4)
+    {
+        for (int k = 0; k < 4; ++k)
+            step(k, i + k);
+    }
+    for (; i < words; ++i)
+        step(0, i);
+
+    std::uint64_t h = spheres.size();
+    for (auto lane : lanes)
+        h = finish(h ^ lane);
+    return h;
+}
+
+// Checks that nodes form the tree build_bvh makes over spheres: children laid
+// out depth first, leaves covering every sphere once and in order, each box
+// enclosing what is below it, and no deeper than flat_scene's traversal
+// stack.  A tree that passes renders the same as a fresh build.
+class bvh_checker
+{
+  public:
+    bvh_checker(std::span<const sphere_record> s, std::span<const bvh_node> n) : spheres{s}, nodes{n} {}
+
+    bool check()
+    {
+        if (nodes.empty())
+            return spheres.empty();
+        return visit(0, 0) && next_node == nodes.size() && next_sphere == spheres.size();
+    }
+
+  private:
+    static constexpr int max_depth = 63;
+
+    template <typename B>
+    static bool encloses(const bvh_node &n, const B &b)
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            if (!(n.lower[a] <= b.lower[a] && b.upper[a] <= n.upper[a]))
+                return false;
+        }
+        return true;
+    }
+
+    bool visit(std::uint64_t index, int depth)
+    {
+        if (depth > max_depth || index != next_node || index >= nodes.size())
+            return false;
+        ++next_node;
+
+        const auto &n = nodes[index];
+        if (n.count > 0)
+        {
+            if (n.offset != next_sphere || n.count > spheres.size() - next_sphere)
+                return false;
+            for (std::uint64_t i = n.offset; i < n.offset + n.count; ++i)
+            {
+                if (!encloses(n, sphere_box(spheres[i])))
+                    return false;
+            }
+            next_sphere += n.count;
+            return true;
+        }
+
+        if (index + 1 >= nodes.size() || n.offset >= nodes.size() || !encloses(n, nodes[index + 1]) ||
+            !encloses(n, nodes[n.offset]))
+            return false;
+        return visit(index + 1, depth + 1) && visit(n.offset, depth + 1);
+    }
+
+    std::span<const sphere_record> spheres;
+    std::span<const bvh_node>      nodes;
+    std::uint64_t                  next_node   = 0;
+    std::uint64_t                  next_sphere = 0;
+};
+
+// Read the entry at path into order and nodes.  Returns false, with the
+// reason in why, if it is missing or does not belong to a scene of hash and
+// sphere_count.
+inline bool read_bvh_cache(const std::filesystem::path &path, std::uint64_t hash, std::uint64_t sphere_count,
+                           std::vector<std::uint32_t> &order, std::vector<bvh_node> &nodes, double &build_ms,
+                           std::string &why)
+{
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in)
+    {
+        why = "no entry";
+        return false;
+    }
+    auto             bytes = static_cast<std::uint64_t>(in.tellg());
+    bvh_cache_header h{};
+    in.seekg(0);
+    if (bytes < sizeof(h) || !in.read(reinterpret_cast<char *>(&h), sizeof(h)) ||
+        std::memcmp(h.magic, bvh_cache_magic, sizeof(h.magic)) != 0)
+    {
+        why = "not a BVH cache entry";
+        return false;
+    }
+    if (h.version != bvh_cache_version || h.header_bytes != sizeof(h))
+    {
+        why = "written by another version";
+        return false;
+    }
+    if (h.scene_hash != hash || h.sphere_count != sphere_count)
+    {
+        why = "built for a different scene";
+        return false;
+    }
+    if (h.node_count > bytes || bytes != sizeof(h) + h.sphere_count * sizeof(std::uint32_t) + h.node_count * sizeof(bvh_node))
+    {
+        why = "truncated or damaged";
+        return false;
+    }
+
+    order.resize(h.sphere_count);
+    nodes.resize(h.node_count);
+    in.read(reinterpret_cast<char *>(order.data()), static_cast<std::streamsize>(order.size() * sizeof(std::uint32_t)));
+    in.read(reinterpret_cast<char *>(nodes.data()), static_cast<std::streamsize>(nodes.size() * sizeof(bvh_node)));
+    if (!in)
+    {
+        why = "cannot be read";
+        return false;
+    }
+
+    // order must be a permutation, or reordering would lose spheres.
+    std::vector<bool> seen(order.size());
+    for (auto i : order)
+    {
+        if (i >= order.size() || seen[i])
+        {
+            why = "truncated or damaged";
+            return false;
+        }
+        seen[i] = true;
+    }
+    build_ms = h.build_ms;
+    return true;
+}
+
+// Write an entry through a temporary file renamed into place, so a render
+// starting meanwhile never reads half of one.  Returns false, after reporting
+// the problem on err, if it cannot be written.
+inline bool write_bvh_cache(const std::filesystem::path &path, std::uint64_t hash,
+                            const std::vector<std::uint32_t> &order, const std::vector<bvh_node> &nodes,
+                            double build_ms, std::ostream &err)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    bvh_cache_header h{};
+    std::memcpy(h.magic, bvh_cache_magic, sizeof(h.magic));
+    h.version      = bvh_cache_version;
+    h.header_bytes = sizeof(h);
+    h.scene_hash   = hash;
+    h.sphere_count = order.size();
+    h.node_count   = nodes.size();
+    h.build_ms     = build_ms;
+
+    auto temporary = path;
+    temporary += ".tmp" + std::to_string(std::random_device{}());
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+        out.write(reinterpret_cast<const char *>(order.data()), static_cast<std::streamsize>(order.size() * sizeof(std::uint32_t)));
+        out.write(reinterpret_cast<const char *>(nodes.data()), static_cast<std::streamsize>(nodes.size() * sizeof(bvh_node)));
+        out.close();
+        if (out)
+            std::filesystem::rename(temporary, path, ec);
+        if (!out || ec)
+        {
+            std::filesystem::remove(temporary, ec);
+            err << "Could not write BVH cache entry " << path.string() << '\n';
+            return false;
+        }
+    }
+    return true;
+}
+
+// build_bvh through the cache in directory: the BVH is taken from the entry
+// for these spheres if there is a good one, and built and stored otherwise.
+// Either way the spheres end up in the same order with the same tree.  What
+// happened is reported on log; a cache that cannot be written is reported
+// but not an error.
+inline std::vector<bvh_node> cached_bvh(std::vector<sphere_record> &spheres, const std::string &directory,
+                                        std::ostream &log)
+{
+    using clock  = std::chrono::steady_clock;
+    auto start   = clock::now();
+    auto elapsed = [&]() { return std::chrono::duration<double, std::milli>(clock::now() - start).count(); };
+
+    auto hash = hash_spheres(spheres);
+    char name[24];
+    std::snprintf(name, sizeof(name), "%016llx.bvh", static_cast<unsigned long long>(hash));
+    auto path = std::filesystem::path(directory) / name;
+
+    std::vector<std::uint32_t> order;
+    std::vector<bvh_node>      nodes;
+    double                     build_ms = 0;
+    std::string                why;
+    if (read_bvh_cache(path, hash, spheres.size(), order, nodes, build_ms, why))
+    {
+        auto cached = spheres;
+        reorder_spheres(cached, order);
+        if (bvh_checker(cached, nodes).check())
+        {
+            spheres.swap(cached);
+            auto load_ms = elapsed();
+            log << "BVH cache hit: " << nodes.size() << " nodes from " << path.string() << " in " << load_ms
+                << " ms, saving " << std::max(0.0, build_ms - load_ms) << " ms of building.\n";
+            return nodes;
+        }
+        why = "does not fit the scene";
+    }
+    if (why != "no entry")
+        log << "BVH cache entry " << path.string() << " ignored: " << why << ".\n";
+
+    start    = clock::now();
+    nodes    = build_bvh(spheres, &order);
+    build_ms = elapsed();
+    bool stored = write_bvh_cache(path, hash, order, nodes, build_ms, log);
+    log << "BVH cache miss: built " << nodes.size() << " nodes in " << build_ms << " ms"
+        << (stored ? ", cached in " + path.string() : std::string()) << ".\n";
+    return nodes;
+}
+
+#endif
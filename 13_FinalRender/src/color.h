@@ -27,9 +27,9 @@ void write_color(std::ostream &out, color pixel_color, int samples_per_pixel)
     b          = std::sqrt(scale * b);
 
     // Write the translated [0,255] value of each color component.
-    std::cout << static_cast<int>(256 * clamp(r, 0.0, 0.999)) << ' '
-              << static_cast<int>(256 * clamp(g, 0.0, 0.999)) << ' '
-              << static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
+    out << static_cast<int>(256 * clamp(r, 0.0, 0.999)) << ' '
+        << static_cast<int>(256 * clamp(g, 0.0, 0.999)) << ' '
+        << static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,298 @@
+#include "bench.h"
+#include "bench_history.h"
+#include "bench_scenes.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "image_error.h"
+#include "options.h"
+#include "region.h"
+#include "render.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Error against time: each scene is rendered at 1, 2, 4 ... samples per
+// pixel, every render timed and compared with a high sample count reference.
+// Sampling and integrator changes are judged by the error they reach in a
+// given time, or by the efficiency 1 / (relMSE x seconds), which stays level
+// as the samples grow for an unbiased renderer and rises with a better one.
+//
+// The renders use other pixel streams than the reference (frame 1, 2 ...
+// against frame 0), so their noise is independent of its.  References take
+// long to render and can be kept in a directory with --references; one is
+// reused when scene, size, depth and sample count match.  --csv writes a
+// table to plot, for instance with gnuplot:
+//
+//   convergence_bench --csv error.csv > error.json
+//   plot 'error.csv' using 3:5 with linespoints   (set logscale xy)
+
+struct timed_image
+{
+    framebuffer image;
+    double      seconds = 0;
+};
+
+static timed_image render_image(const workload &w, int width, int height, int samples, int max_depth, int frame,
+                                int threads)
+{
+    const auto     &view = w.scene->description.camera;
+    camera          cam(view.lookfrom, view.lookat, view.vup, view.vfov, static_cast<double>(width) / height, view.aperture,
+                        view.focus_dist);
+    render_settings settings{width, height, samples, max_depth, frame};
+    render_region   region(width, height);
+    timed_image     result{framebuffer(width, height)};
+
+    auto start = std::chrono::steady_clock::now();
+    render_tiles(cam, w.scene->world, settings, region, 32, threads, framebuffer_sink(result.image, region.bounds()));
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+// "generated:1000" becomes "generated-1000", which every file system takes.
+static std::string file_stem(const workload &w, int width, int height, int samples)
+{
+    auto name = w.name;
+    std::replace(name.begin(), name.end(), ':', '-');
+    return name + '_' + std::to_string(width) + 'x' + std::to_string(height) + '_' + std::to_string(samples) + "spp";
+}
+
+static bool write_pfm_file(const std::string &path, const framebuffer &image, std::ostream &err)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    std::ofstream out(path, std::ios::binary);
+    write_pfm(out, image);
+    out.close();
+    if (!out)
+    {
+        err << "Could not write " << path << '\n';
+        return false;
+    }
+    return true;
+}
+
+// The reference from directory if it holds one, else rendered and, with a
+// directory, kept there.
+static bool reference_image(const workload &w, int width, int height, int samples, int max_depth, int threads,
+                            const std::string &directory, framebuffer &reference, std::ostream &err)
+{
+    std::string path;
+    if (!directory.empty())
+    {
+        path = (std::filesystem::path(directory) /
+                (file_stem(w, width, height, samples) + "_d" + std::to_string(max_depth) + ".pfm"))
+                   .string();
+        std::ifstream in(path, std::ios::binary);
+        if (in && read_pfm(in, reference, err) && reference.width() == width && reference.height() == height)
+        {
+            err << "Using reference " << path << '\n';
+            return true;
+        }
+    }
+
+    err << "Rendering the " << w.name << " reference at " << samples << " samples per pixel...\n";
+    auto rendered = render_image(w, width, height, samples, max_depth, 0, threads);
+    err << "Reference took " << format_duration(rendered.seconds) << ".\n";
+    reference = std::move(rendered.image);
+    return path.empty() || write_pfm_file(path, reference, err);
+}
+
+static void print_convergence_usage(std::ostream &out, const char *program)
+{
+    out << "Usage: " << program << " [options] > convergence.json\n"
+        << "\n"
+        << "  --scenes list        scenes to render: random (the built-in scene),\n"
+        << "                       random:seed, generated:n (default\n"
+        << "                       random,generated:100000)\n"
+        << "  --size WxH           image size (default 160x107)\n"
+        << "  --reference-spp n    samples per pixel of the reference (default 1024)\n"
+        << "  --max-spp n          most samples per pixel to compare (default 256)\n"
+        << "  --max-time s         stop a scene after a render taking this long\n"
+        << "                       (default 30)\n"
+        << "  --max-depth n        ray bounce limit (default 50)\n"
+        << "  --threads n          render threads (default: all cores)\n"
+        << "  --references dir     keep references in dir and reuse them\n"
+        << "  --images dir         also write every render to dir as PFM\n"
+        << "  --csv file           write scene, spp, seconds and errors as CSV\n"
+        << "  --output file        write the JSON to file instead of standard output\n"
+        << "  --history file       also append the results to a benchmark history file\n"
+        << "  --help               show this message\n";
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> scene_specs   = {"random", "generated:100000"};
+    std::string              size          = "160x107";
+    int                      reference_spp = 1024;
+    int                      max_spp       = 256;
+    double                   max_time      = 30;
+    int                      max_depth     = 50;
+    int                      threads       = default_thread_count();
+    std::string              references, images, csv, output, history;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            print_convergence_usage(std::cout, argv[0]);
+            return 0;
+        }
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << arg << '\n';
+            print_convergence_usage(std::cerr, argv[0]);
+            return 1;
+        }
+        std::string value = argv[++i];
+        int         w = 0, h = 0;
+        bool        good = true;
+        if (arg == "--scenes")
+            scene_specs = split_list(value);
+        else if (arg == "--size")
+        {
+            size = value;
+            good = parse_size_pair(value, w, h);
+        }
+        else if (arg == "--reference-spp")
+            good = parse_int(value, reference_spp) && reference_spp > 0;
+        else if (arg == "--max-spp")
+            good = parse_int(value, max_spp) && max_spp > 0;
+        else if (arg == "--max-time")
+            good = parse_double(value, max_time) && max_time > 0;
+        else if (arg == "--max-depth")
+            good = parse_int(value, max_depth) && max_depth > 0;
+        else if (arg == "--threads")
+            good = parse_int(value, threads) && threads > 0;
+        else if (arg == "--references")
+            references = value;
+        else if (arg == "--images")
+            images = value;
+        else if (arg == "--csv")
+            csv = value;
+        else if (arg == "--output" || arg == "-o")
+            output = value;
+        else if (arg == "--history")
+            history = value;
+        else
+        {
+            std::cerr << "Unknown option " << arg << '\n';
+            print_convergence_usage(std::cerr, argv[0]);
+            return 1;
+        }
+        if (!good)
+        {
+            std::cerr << "Bad " << arg << " value '" << value << "'\n";
+            return 1;
+        }
+    }
+    if (max_spp >= reference_spp)
+    {
+        std::cerr << "--max-spp must be below --reference-spp, or the reference is no better than the renders\n";
+        return 1;
+    }
+
+    int width = 0, height = 0;
+    parse_size_pair(size, width, height);
+
+    std::ofstream table;
+    if (!csv.empty())
+    {
+        table.open(csv);
+        if (!table)
+        {
+            std::cerr << "Could not open " << csv << '\n';
+            return 1;
+        }
+        table << "scene,spp,seconds,mse,rel_mse,psnr,efficiency\n";
+    }
+
+    bench_settings settings;
+    settings.repetitions = 1;
+    bench_runner results(settings);
+
+    for (const auto &spec : scene_specs)
+    {
+        workload w;
+        if (!make_workload(spec, w, std::cerr))
+            return 1;
+        framebuffer reference;
+        if (!reference_image(w, width, height, reference_spp, max_depth, threads, references, reference, std::cerr))
+            return 1;
+
+        std::cerr << std::left << std::setw(22) << "scene" << std::right << std::setw(6) << "spp" << std::setw(10)
+                  << "seconds" << std::setw(12) << "MSE" << std::setw(12) << "relMSE" << std::setw(9) << "PSNR"
+                  << std::setw(12) << "efficiency" << '\n';
+        int frame = 1;
+        for (int spp = 1; spp <= max_spp; spp *= 2)
+        {
+            auto render     = render_image(w, width, height, spp, max_depth, frame++, threads);
+            auto error      = compare_images(render.image, reference);
+            auto efficiency = 1.0 / (error.rel_mse * render.seconds);
+
+            std::cerr << std::left << std::setw(22) << spec << std::right << std::setw(6) << spp << std::fixed
+                      << std::setprecision(3) << std::setw(10) << render.seconds << std::scientific
+                      << std::setprecision(3) << std::setw(12) << error.mse << std::setw(12) << error.rel_mse
+                      << std::fixed << std::setprecision(2) << std::setw(9) << error.psnr << std::scientific
+                      << std::setprecision(3) << std::setw(12) << efficiency << '\n';
+            std::cerr.unsetf(std::ios::floatfield);
+
+            if (table.is_open())
+            {
+                table << spec << ',' << spp << ',' << render.seconds << ',' << error.mse << ',' << error.rel_mse << ','
+                      << error.psnr << ',' << efficiency << '\n';
+            }
+            if (!images.empty() &&
+                !write_pfm_file((std::filesystem::path(images) / (file_stem(w, width, height, spp) + ".pfm")).string(),
+                                render.image, std::cerr))
+                return 1;
+
+            bench_result r;
+            r.name       = "convergence/" + spec + "/" + size + "/spp:" + std::to_string(spp);
+            r.iterations = 1;
+            r.ns_per_op  = render.seconds * 1.0e9;
+            r.min_ns     = r.ns_per_op;
+            r.max_ns     = r.ns_per_op;
+            r.counters   = {{"samples_per_pixel", spp},
+                            {"mse", error.mse},
+                            {"rel_mse", error.rel_mse},
+                            {"psnr", error.psnr},
+                            {"efficiency", efficiency}};
+            results.add(r);
+
+            if (render.seconds >= max_time)
+                break;
+        }
+    }
+
+    if (table.is_open())
+    {
+        table.close();
+        if (!table)
+        {
+            std::cerr << "Could not write " << csv << '\n';
+            return 1;
+        }
+    }
+    if (!history.empty() && !append_history(history, argv[0], results.all(), std::cerr))
+        return 1;
+    if (output.empty())
+    {
+        results.write_json(std::cout, argv[0]);
+        return 0;
+    }
+    std::ofstream file(output);
+    results.write_json(file, argv[0]);
+    if (!file)
+    {
+        std::cerr << "Could not write " << output << '\n';
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,232 @@
+#ifndef FLAT_SCENE_H
+#define FLAT_SCENE_H
+
+#include "hittable.h"
+#include "material.h"
+#include "metrics.h"
+#include "ray.h"
+#include "traversal_stats.h"
+#include "vec3.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+// Scenes as flat arrays of plain records instead of a list of heap objects.
+//
+// Spheres refer to materials by index and the bounding volume hierarchy
+// refers to spheres and child nodes by index, so none of the three arrays
+// holds a pointer.  They can be filled by the text parser, written to disk
+// and used again straight from a read-only mapping of the file
+// (binary_scene.h), with no step that rebuilds objects from them.
+
+enum class material_type : std::uint32_t
+{
+    lambertian = 0,
+    metal      = 1,
+    dielectric = 2
+};
+
+// parameter is the fuzz of a metal and the index of refraction of a
+// dielectric.
+struct material_record
+{
+    material_type type;
+    std::uint32_t padding;
+    double        albedo[3];
+    double        parameter;
+};
+
+struct sphere_record
+{
+    double        center[3];
+    double        radius;
+    std::uint32_t material;
+    std::uint32_t padding;
+};
+
+// An interior node's left child follows it directly and offset is its right
+// child; a leaf (count > 0) covers spheres offset to offset + count - 1.
+// Bounds are floats rounded outwards, which halves the node to 32 bytes.
+struct bvh_node
+{
+    float         lower[3];
+    std::uint32_t offset;
+    float         upper[3];
+    std::uint32_t count;
+};
+
+static_assert(std::is_trivially_copyable_v<material_record> && sizeof(material_record) == 40);
+static_assert(std::is_trivially_copyable_v<sphere_record> && sizeof(sphere_record) == 40);
+static_assert(std::is_trivially_copyable_v<bvh_node> && sizeof(bvh_node) == 32);
+
+// One material object standing in for a whole table of material records: a
+// hit carries its record's index and scatter builds the matching material on
+// the stack, so the table needs no object per entry.
+class material_table : public material
+{
+  public:
+    material_table() {}
+    explicit material_table(std::span<const material_record> m) : records{m} {}
+
+    virtual bool scatter(const ray &r_in, const hit_record &rec, color &attenuation, ray &scattered) const override
+    {
+        const auto &m = records[rec.material_index];
+        color       albedo(m.albedo[0], m.albedo[1], m.albedo[2]);
+        switch (m.type)
+        {
+            case material_type::lambertian:
+                return lambertian(albedo).scatter(r_in, rec, attenuation, scattered);
+            case material_type::metal:
+                return metal(albedo, m.parameter).scatter(r_in, rec, attenuation, scattered);
+            case material_type::dielectric:
+                return dielectric(m.parameter).scatter(r_in, rec, attenuation, scattered);
+        }
+        return false;
+    }
+
+  private:
+    std::span<const material_record> records;
+};
+
+// Spheres found through a BVH, all three arrays only viewed.  The storage
+// (vectors or a file mapping) must outlive the scene.
+class flat_scene : public hittable
+{
+  public:
+    flat_scene() {}
+    flat_scene(std::span<const sphere_record> s, std::span<const material_record> m, std::span<const bvh_node> n)
+        : spheres{s}, nodes{n}, materials{m}
+    {
+    }
+
+    std::size_t sphere_count() const { return spheres.size(); }
+
+    virtual bool hit(const ray &r, double t_min, double t_max, hit_record &rec) const override
+    {
+        if (nodes.empty())
+            return false;
+
+        const vec3 origin    = r.origin();
+        const vec3 direction = r.direction();
+        const vec3 inverse(1.0 / direction.x(), 1.0 / direction.y(), 1.0 / direction.z());
+
+        // build_bvh keeps trees shallower than this.
+        std::uint32_t stack[64];
+        int           depth   = 0;
+        std::uint32_t node    = 0;
+        std::uint32_t closest = 0;
+        bool          found   = false;
+        std::uint64_t tests   = 0;
+        std::uint64_t boxes   = 0;
+
+        for (;;)
+        {
+            const auto &n = nodes[node];
+            ++boxes;
+            if (enters(n, origin, inverse, t_min, t_max))
+            {
+                if (n.count == 0)
+                {
+                    // Visit the child on the ray's side first so later boxes
+                    // are more often cut off by a closer hit.
+                    std::uint32_t near_child = node + 1;
+                    std::uint32_t far_child  = n.offset;
+                    if (nearer_second(nodes[near_child], nodes[far_child], direction))
+                        std::swap(near_child, far_child);
+                    stack[depth++] = far_child;
+                    node           = near_child;
+                    continue;
+                }
+
+                tests += n.count;
+                for (std::uint32_t i = n.offset; i < n.offset + n.count; ++i)
+                {
+                    double t = 0;
+                    if (hit_sphere(spheres[i], origin, direction, t_min, t_max, t))
+                    {
+                        t_max   = t;
+                        closest = i;
+                        found   = true;
+                    }
+                }
+            }
+            if (depth == 0)
+                break;
+            node = stack[--depth];
+        }
+
+        metrics_add(this_thread_metrics->intersection_tests, tests);
+        count_box_tests(boxes);
+        count_primitive_tests(tests);
+        if (!found)
+            return false;
+
+        // Same arithmetic as sphere::hit, so a scene renders identically
+        // whichever way it is held.
+        const auto &s = spheres[closest];
+        point3      center(s.center[0], s.center[1], s.center[2]);
+        rec.t               = t_max;
+        rec.p               = r.at(rec.t);
+        vec3 outward_normal = (rec.p - center) / s.radius;
+        rec.set_face_normal(r, outward_normal);
+        rec.mat_ptr        = &materials;
+        rec.material_index = s.material;
+        return true;
+    }
+
+  private:
+    static bool enters(const bvh_node &n, const vec3 &origin, const vec3 &inverse, double t_min, double t_max)
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            double t0 = (n.lower[a] - origin[a]) * inverse[a];
+            double t1 = (n.upper[a] - origin[a]) * inverse[a];
+            t_min     = std::max(t_min, std::min(t0, t1));
+            t_max     = std::min(t_max, std::max(t0, t1));
+        }
+        return t_min <= t_max;
+    }
+
+    // True if b's centre lies before a's along the ray direction.
+    static bool nearer_second(const bvh_node &a, const bvh_node &b, const vec3 &direction)
+    {
+        double along = 0;
+        for (int k = 0; k < 3; ++k)
+            along += (b.lower[k] + b.upper[k] - a.lower[k] - a.upper[k]) * direction[k];
+        return along < 0;
+    }
+
+    static bool hit_sphere(const sphere_record &s, const vec3 &origin, const vec3 &direction, double t_min,
+                           double t_max, double &t)
+    {
+        vec3 oc     = origin - point3(s.center[0], s.center[1], s.center[2]);
+        auto a      = direction.length_squared();
+        auto half_b = dot(oc, direction);
+        auto c      = oc.length_squared() - s.radius * s.radius;
+
+        auto discriminant = half_b * half_b - a * c;
+        if (discriminant < 0)
+            return false;
+        auto sqrtd = std::sqrt(discriminant);
+
+        auto root = (-half_b - sqrtd) / a;
+        if (root < t_min || t_max < root)
+        {
+            root = (-half_b + sqrtd) / a;
+            if (root < t_min || t_max < root)
+                return false;
+        }
+        t = root;
+        return true;
+    }
+
+    std::span<const sphere_record> spheres;
+    std::span<const bvh_node>      nodes;
+    material_table                 materials;
+};
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "image_encoder.h"
+#include "png.h"
+#include "ppm.h"
+#include "qoi.h"
+#include "tonemap.h"
+#include "vec3.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Linear RGB image in single precision, top scanline first.  The render loop
+// stores each pixel's averaged radiance here; exposure, the transfer curve and
+// quantization happen once for the whole image when it is written out.
+
+class framebuffer
+{
+  public:
+    framebuffer() {}
+    framebuffer(int w, int h) : image_width{w}, image_height{h}, values(static_cast<std::size_t>(w) * h * 3, 0.0f) {}
+
+    int width() const { return image_width; }
+    int height() const { return image_height; }
+
+    void set(int x, int y, const color &c)
+    {
+        auto k        = index(x, y);
+        values[k]     = static_cast<float>(c.x());
+        values[k + 1] = static_cast<float>(c.y());
+        values[k + 2] = static_cast<float>(c.z());
+    }
+
+    color get(int x, int y) const
+    {
+        auto k = index(x, y);
+        return color(values[k], values[k + 1], values[k + 2]);
+    }
+
+    const float *row(int y) const { return values.data() + index(0, y); }
+    float       *row(int y) { return values.data() + index(0, y); }
+
+    const std::vector<float> &data() const { return values; }
+
+  private:
+    std::size_t index(int x, int y) const
+    {
+        return (static_cast<std::size_t>(y) * image_width + x) * 3;
+    }
+
+    int                image_width  = 0;
+    int                image_height = 0;
+    std::vector<float> values;
+};
+
+// Tone-map the whole framebuffer to bytes.  Rows are split between
+// thread_count threads so the conversion of even an 8K frame takes a few
+// milliseconds.
+inline std::vector<std::uint8_t> quantize(const framebuffer &fb, const tonemap &tone, int thread_count)
+{
+    std::vector<std::uint8_t> bytes(fb.data().size());
+    auto                      row_values = static_cast<std::size_t>(fb.width()) * 3;
+    int                       parts      = std::max(1, std::min(thread_count, fb.height()));
+
+    auto convert = [&](int part)
+    {
+        int y0 = fb.height() * part / parts;
+        int y1 = fb.height() * (part + 1) / parts;
+        tone.apply(fb.row(y0), bytes.data() + y0 * row_values, (y1 - y0) * row_values);
+    };
+
+    std::vector<std::thread> workers;
+    for (int part = 1; part < parts; ++part)
+        workers.emplace_back(convert, part);
+    convert(0);
+    for (auto &w : workers)
+        w.join();
+    return bytes;
+}
+
+// PFM stores little-endian floats (signalled by the negative scale) with the
+// bottom scanline first.  The format has no room for comments.
+inline void write_pfm(std::ostream &out, const framebuffer &fb)
+{
+    out << "PF\n"
+        << fb.width() << ' ' << fb.height() << "\n-1.0\n";
+    for (int y = fb.height() - 1; y >= 0; --y)
+        out.write(reinterpret_cast<const char *>(fb.row(y)), static_cast<std::streamsize>(sizeof(float) * 3 * fb.width()));
+}
+
+// Read what write_pfm wrote.  Returns false, after reporting the problem on
+// err, for anything else, including big-endian and greyscale PFM.
+inline bool read_pfm(std::istream &in, framebuffer &fb, std::ostream &err)
+{
+    std::string magic;
+    int         width = 0, height = 0;
+    double      scale = 0;
+    if (!(in >> magic >> width >> height >> scale) || magic != "PF" || width <= 0 || height <= 0 || scale >= 0)
+    {
+        err << "Not a little-endian colour PFM image\n";
+        return false;
+    }
+    in.get();
+
+    fb = framebuffer(width, height);
+    for (int y = height - 1; y >= 0; --y)
+        in.read(reinterpret_cast<char *>(fb.row(y)), static_cast<std::streamsize>(sizeof(float) * 3 * width));
+    if (!in)
+    {
+        err << "PFM image ends early\n";
+        return false;
+    }
+    return true;
+}
+
+// An encoder for the 8-bit formats; PFM is written directly from floats.
+// thread_count is the number of threads PNG may use to compress each band.
+inline std::unique_ptr<image_encoder> make_encoder(std::ostream &out, image_format format, int width, int height,
+                                                   const std::vector<std::string> &comments, int thread_count)
+{
+    switch (format)
+    {
+        case image_format::PNG:
+            return std::make_unique<png_encoder>(out, width, height, thread_count, comments);
+        case image_format::QOI:
+            return std::make_unique<qoi_encoder>(out, width, height);
+        case image_format::P6:
+            return std::make_unique<ppm_encoder>(out, width, height, true, comments);
+        default:
+            return std::make_unique<ppm_encoder>(out, width, height, false, comments);
+    }
+}
+
+// PFM keeps the linear values, so tone only applies to the 8-bit formats.
+inline void write_image(std::ostream &out, const framebuffer &fb, image_format format,
+                        const std::vector<std::string> &comments, const tonemap &tone, int thread_count)
+{
+    if (format == image_format::PFM)
+    {
+        write_pfm(out, fb);
+        out.flush();
+        return;
+    }
+
+    auto bytes   = quantize(fb, tone, thread_count);
+    auto encoder = make_encoder(out, format, fb.width(), fb.height(), comments, thread_count);
+    encoder->write_rows(bytes.data(), fb.height());
+    encoder->finish();
+    encoder->report(std::cerr, format);
+}
+
+#endif
\ No newline at end of file
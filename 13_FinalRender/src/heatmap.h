@@ -0,0 +1,229 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include "framebuffer.h"
+#include "metrics.h"
+#include "region.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// What each pixel cost to render, written as a false-colour image next to the
+// beauty image so sampling and acceleration work can go where the time goes:
+// glass, nested reflections, the ground.
+//
+// render_pixel measures the pixel through a cost_probe when the settings
+// carry a cost_map.  The probe reads the time stamp counter and the calling
+// thread's metrics counters before and after, so it needs nothing from
+// ray_color or the scene.  Without a map the probe is a null pointer test per
+// pixel.
+
+enum class cost_metric
+{
+    time,  // time stamp counter ticks (nanoseconds where there is none)
+    tests, // ray-sphere intersection tests
+    depth  // rays per path, averaged over the pixel's samples
+};
+
+inline bool parse_cost_metric(const std::string &name, cost_metric &metric)
+{
+    if (name == "time")
+        metric = cost_metric::time;
+    else if (name == "tests")
+        metric = cost_metric::tests;
+    else if (name == "depth")
+        metric = cost_metric::depth;
+    else
+        return false;
+    return true;
+}
+
+// The time stamp counter where there is one: a few cycles to read, against
+// tens of nanoseconds for the steady clock.
+inline std::uint64_t cost_clock()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// One cost per pixel of the region's bounding box.  Workers record disjoint
+// pixels, so they need no lock.
+class cost_map
+{
+  public:
+    cost_map(cost_metric m, const pixel_rect &b)
+        : metric{m}, bounds{b}, costs(static_cast<std::size_t>(b.width()) * b.height(), 0.0f)
+    {
+    }
+
+    cost_metric kind() const { return metric; }
+
+    void record(int x, int y, float cost)
+    {
+        costs[static_cast<std::size_t>(y - bounds.y0) * bounds.width() + (x - bounds.x0)] = cost;
+    }
+
+    const char *unit() const
+    {
+        switch (metric)
+        {
+            case cost_metric::time:
+#if defined(__x86_64__) || defined(__i386__)
+                return "TSC ticks per pixel";
+#else
+                return "ns per pixel";
+#endif
+            case cost_metric::tests:
+                return "intersection tests per pixel";
+            case cost_metric::depth:
+                return "rays per path";
+        }
+        return "";
+    }
+
+    // Write the map to path: raw costs in all three channels for a .pfm
+    // file, and otherwise a false-colour PNG (.png), QOI (.qoi) or binary PPM
+    // scaled so the 99th percentile is the hottest colour, which keeps a few
+    // outliers from flattening the rest.  Returns false, after reporting the
+    // problem on err, if it cannot be written.
+    bool write(const std::string &path, std::ostream &err) const
+    {
+        std::ofstream out(path, std::ios::binary);
+        if (!out)
+        {
+            err << "Could not open heatmap file " << path << '\n';
+            return false;
+        }
+
+        auto extension = path.substr(std::min(path.size(), path.rfind('.')));
+        auto top       = percentile(0.99);
+        framebuffer fb(bounds.width(), bounds.height());
+        for (int y = 0; y < bounds.height(); ++y)
+        {
+            for (int x = 0; x < bounds.width(); ++x)
+            {
+                float c = costs[static_cast<std::size_t>(y) * bounds.width() + x];
+                fb.set(x, y, extension == ".pfm" ? color(c, c, c) : false_colour(top > 0 ? c / top : 0.0f));
+            }
+        }
+
+        auto format = extension == ".pfm"   ? image_format::PFM
+                      : extension == ".png" ? image_format::PNG
+                      : extension == ".qoi" ? image_format::QOI
+                                            : image_format::P6;
+        if (format == image_format::PFM)
+        {
+            write_pfm(out, fb);
+        }
+        else
+        {
+            // The colours are chosen for display, so they go out without a
+            // transfer curve.
+            std::vector<std::uint8_t> bytes(fb.data().size());
+            for (std::size_t k = 0; k < bytes.size(); ++k)
+                bytes[k] = static_cast<std::uint8_t>(255.0f * std::clamp(fb.data()[k], 0.0f, 1.0f) + 0.5f);
+            auto encoder = make_encoder(out, format, fb.width(), fb.height(), {}, 1);
+            encoder->write_rows(bytes.data(), fb.height());
+            encoder->finish();
+        }
+        out.close();
+        if (!out)
+        {
+            err << "Could not write heatmap file " << path << '\n';
+            return false;
+        }
+
+        err << "Heatmap of " << unit() << " written to " << path << ": median " << percentile(0.5)
+            << ", 99th percentile " << top << ", maximum " << percentile(1.0) << ".\n";
+        return true;
+    }
+
+  private:
+    float percentile(double p) const
+    {
+        if (costs.empty())
+            return 0;
+        auto sorted = costs;
+        auto k      = static_cast<std::size_t>(p * static_cast<double>(sorted.size() - 1));
+        std::nth_element(sorted.begin(), sorted.begin() + static_cast<std::ptrdiff_t>(k), sorted.end());
+        return sorted[k];
+    }
+
+    // Black through purple, red and orange to pale yellow as t goes from 0
+    // to 1, the order of a black-body ramp, so brighter always means costlier.
+    static color false_colour(float t)
+    {
+        static const color stops[] = {color(0.00, 0.00, 0.02), color(0.30, 0.05, 0.45), color(0.75, 0.15, 0.35),
+                                      color(0.98, 0.50, 0.05), color(0.99, 0.99, 0.65)};
+        const int          last    = static_cast<int>(std::size(stops)) - 1;
+        double             s       = std::clamp(static_cast<double>(t), 0.0, 1.0) * last;
+        int                i       = std::min(static_cast<int>(s), last - 1);
+        double             f       = s - i;
+        return (1.0 - f) * stops[i] + f * stops[i + 1];
+    }
+
+    cost_metric        metric;
+    pixel_rect         bounds;
+    std::vector<float> costs;
+};
+
+// Measures one pixel from construction to destruction and records it in the
+// map, if there is one.
+class cost_probe
+{
+  public:
+    cost_probe(cost_map *m, int px, int py, int samples) : map{m}, x{px}, y{py}, spp{samples}
+    {
+        if (map == nullptr)
+            return;
+        tests = this_thread_metrics->intersection_tests.load(std::memory_order_relaxed);
+        rays  = this_thread_metrics->secondary_rays.load(std::memory_order_relaxed);
+        start = cost_clock();
+    }
+
+    ~cost_probe()
+    {
+        if (map == nullptr)
+            return;
+        auto  ticks = cost_clock() - start;
+        float cost  = 0;
+        switch (map->kind())
+        {
+            case cost_metric::time:
+                cost = static_cast<float>(ticks);
+                break;
+            case cost_metric::tests:
+                cost = static_cast<float>(this_thread_metrics->intersection_tests.load(std::memory_order_relaxed) - tests);
+                break;
+            case cost_metric::depth:
+                cost = 1.0f + static_cast<float>(this_thread_metrics->secondary_rays.load(std::memory_order_relaxed) - rays) /
+                                  static_cast<float>(spp);
+                break;
+        }
+        map->record(x, y, cost);
+    }
+
+  private:
+    cost_map     *map;
+    int           x;
+    int           y;
+    int           spp;
+    std::uint64_t tests = 0;
+    std::uint64_t rays  = 0;
+    std::uint64_t start = 0;
+};
+
+#endif
@@ -5,19 +5,27 @@
 #include "rtweekend.h"
 #include "vec3.h"
 
+#include <cstdint>
+
 class material;
 
 // A normal's direction from the surface indicates front or back face
 // by the convention chosen.  In this case, a normal will emanate
 // outwards from the front face.
 
+// mat_ptr is a plain pointer because the record is copied on every hit and
+// the material always outlives it; a shared_ptr copy here meant two atomic
+// reference count updates per hit, on counts shared by all render threads.
+// material_index lets one material object stand for a whole table of them
+// (see flat_scene.h).
 struct hit_record
 {
-    point3                    p;
-    vec3                      normal;
-    std::shared_ptr<material> mat_ptr;
-    double                    t;
-    bool                      front_face;
+    point3          p;
+    vec3            normal;
+    const material *mat_ptr;
+    std::uint32_t   material_index;
+    double          t;
+    bool            front_face;
 
     inline void set_face_normal(const ray &r, const vec3 &outward_normal)
     {
@@ -5,6 +5,7 @@
 #include "ray.h"
 
 #include <memory>
+#include <utility>
 #include <vector>
 
 class hittable_list : public hittable
@@ -14,7 +15,7 @@ class hittable_list : public hittable
     hittable_list(std::shared_ptr<hittable> object) { add(object); }
 
     void clear() { objects.clear(); }
-    void add(std::shared_ptr<hittable> object) { objects.push_back(object); }
+    void add(std::shared_ptr<hittable> object) { objects.push_back(std::move(object)); }
 
     virtual bool hit(const ray &r, double t_min, double t_max, hit_record &rec) const override;
 
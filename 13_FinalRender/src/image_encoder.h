@@ -0,0 +1,126 @@
+#ifndef IMAGE_ENCODER_H
+#define IMAGE_ENCODER_H
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+// Output formats.  P3 is the original text PPM, P6 the same image as binary
+// bytes, PFM keeps the linear floats for HDR tools, PNG is compressed and QOI
+// is a fast, lightly compressed format for previews.  Y4M and RGB are
+// uncompressed video streams for --animate.
+enum class image_format
+{
+    P3,
+    P6,
+    PFM,
+    PNG,
+    QOI,
+    Y4M,
+    RGB
+};
+
+inline bool is_video_format(image_format format)
+{
+    return format == image_format::Y4M || format == image_format::RGB;
+}
+
+inline bool parse_image_format(const std::string &name, image_format &format)
+{
+    if (name == "p3" || name == "ppm")
+        format = image_format::P3;
+    else if (name == "p6")
+        format = image_format::P6;
+    else if (name == "pfm")
+        format = image_format::PFM;
+    else if (name == "png")
+        format = image_format::PNG;
+    else if (name == "qoi")
+        format = image_format::QOI;
+    else if (name == "y4m")
+        format = image_format::Y4M;
+    else if (name == "rgb")
+        format = image_format::RGB;
+    else
+        return false;
+    return true;
+}
+
+inline const char *image_format_name(image_format format)
+{
+    switch (format)
+    {
+        case image_format::P3:
+            return "P3";
+        case image_format::P6:
+            return "P6";
+        case image_format::PFM:
+            return "PFM";
+        case image_format::PNG:
+            return "PNG";
+        case image_format::QOI:
+            return "QOI";
+        case image_format::Y4M:
+            return "Y4M";
+        case image_format::RGB:
+            return "RGB";
+    }
+    return "?";
+}
+
+// Writes an 8-bit RGB image of known size to a stream, a band of whole rows
+// at a time and top scanline first, so the same encoder serves whole-frame
+// output, --stream and --max-memory strips.  The header is written by the
+// constructor.  The time spent encoding and writing is tracked so runs can
+// report encoder throughput.
+
+class image_encoder
+{
+  public:
+    image_encoder(std::ostream &o, int w, int h) : out{o}, width{w}, height{h} {}
+    virtual ~image_encoder() = default;
+
+    void write_rows(const std::uint8_t *rgb, int rows)
+    {
+        auto start = std::chrono::steady_clock::now();
+        encode_rows(rgb, rows);
+        bytes_in += static_cast<std::uint64_t>(width) * rows * 3;
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void finish()
+    {
+        auto start = std::chrono::steady_clock::now();
+        encode_end();
+        out.flush();
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void report(std::ostream &err, image_format format) const
+    {
+        auto mb = [](std::uint64_t bytes) { return static_cast<double>(bytes) / 1.0e6; };
+        err << "Encoded " << mb(bytes_in) << " MB of pixels into " << mb(bytes_out) << " MB of "
+            << image_format_name(format) << " in " << seconds * 1000.0 << " ms ("
+            << (seconds > 0 ? mb(bytes_in) / seconds : 0.0) << " MB/s).\n";
+    }
+
+  protected:
+    virtual void encode_rows(const std::uint8_t *rgb, int rows) = 0;
+    virtual void encode_end() {}
+
+    void emit(const void *data, std::size_t count)
+    {
+        out.write(static_cast<const char *>(data), static_cast<std::streamsize>(count));
+        bytes_out += count;
+    }
+
+    std::ostream &out;
+    int           width;
+    int           height;
+    std::uint64_t bytes_in  = 0;
+    std::uint64_t bytes_out = 0;
+    double        seconds   = 0.0;
+};
+
+#endif
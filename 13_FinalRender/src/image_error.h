@@ -0,0 +1,75 @@
+#ifndef IMAGE_ERROR_H
+#define IMAGE_ERROR_H
+
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+// How far a render is from a reference of the same scene, for judging
+// sampling changes by the error they reach in a given time.
+//
+//   mse      mean squared error of the linear values
+//   rel_mse  the same, each term divided by the reference value squared
+//            plus 0.01, so dark and bright regions count alike
+//   psnr     peak signal to noise of the displayed image: values through
+//            the gamma2 curve, clamped to [0,1], in decibels
+//
+// All three are one pass over the floats.  Each sum is kept in eight
+// independent lanes, which lets the compiler use packed instructions
+// without reassociating floating point additions.
+
+struct image_error
+{
+    double mse     = 0;
+    double rel_mse = 0;
+    double psnr    = 0;
+};
+
+// The images must be the same size.
+inline image_error compare_images(const framebuffer &test, const framebuffer &reference)
+{
+    const std::size_t lanes = 8;
+    const float      *a     = test.data().data();
+    const float      *b     = reference.data().data();
+    std::size_t       n     = std::min(test.data().size(), reference.data().size());
+
+    double squared[lanes] = {}, relative[lanes] = {}, displayed[lanes] = {};
+    auto   add            = [&](std::size_t lane, float t, float r)
+    {
+        float d  = t - r;
+        float dd = std::sqrt(std::min(std::max(t, 0.0f), 1.0f)) - std::sqrt(std::min(std::max(r, 0.0f), 1.0f));
+        squared[lane] += static_cast<double>(d * d);
+        relative[lane] += static_cast<double>(d * d / (r * r + 0.01f));
+        displayed[lane] += static_cast<double>(dd * dd);
+    };
+
+    std::size_t k = 0;
+    for (; k + lanes <= n; k += lanes)
+    {
+        for (std::size_t l = 0; l < lanes; ++l)
+            add(l, a[k + l], b[k + l]);
+    }
+    for (; k < n; ++k)
+        add(0, a[k], b[k]);
+
+    image_error e;
+    double      display_mse = 0;
+    for (std::size_t l = 0; l < lanes; ++l)
+    {
+        e.mse += squared[l];
+        e.rel_mse += relative[l];
+        display_mse += displayed[l];
+    }
+    if (n == 0)
+        return e;
+    e.mse /= static_cast<double>(n);
+    e.rel_mse /= static_cast<double>(n);
+    display_mse /= static_cast<double>(n);
+    e.psnr = display_mse > 0 ? -10.0 * std::log10(display_mse) : std::numeric_limits<double>::infinity();
+    return e;
+}
+
+#endif
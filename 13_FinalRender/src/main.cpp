@@ -3,100 +3,53 @@
 
 #include "rtweekend.h"
 
+#include "allocation_tracking.h"
+#include "animation.h"
+#include "async_file.h"
+#include "bench_history.h"
+#include "binary_scene.h"
 #include "camera.h"
 #include "color.h"
-#include "hittable_list.h"
+#include "framebuffer.h"
+#include "heatmap.h"
+#include "mapped_image.h"
+#include "metrics.h"
 #include "material.h"
-#include "sphere.h"
-
+#include "options.h"
+#include "perf_counters.h"
+#include "random_scene.h"
+#include "region.h"
+#include "render.h"
+#include "row_stream.h"
+#include "scene_file.h"
+#include "scene_generator.h"
+#include "strip_render.h"
+#include "trace.h"
+#include "traversal_stats.h"
+
+#include <chrono>
+#include <filesystem>
 #include <iostream>
+#include <optional>
 
-// If the cast ray hits the sphere t will be the value used to
-// compute the point of intersection.  Create a new ray from the
-// center of the sphere to this point.  This vector is the
-// surface normal.  The value can range from -1 to 1.  Scale to
-// 0 to 1 to get color gradient to color the sphere.
-// Limit recursion, or ray bouncing, to depth number of recursive calls.
-
-color ray_color(const ray &r, const hittable &world, int depth)
+// The run's line in --history: the render and its output, named by scene,
+// size, samples and threads so repeated runs of one render pool together.
+static bool append_render_history(const render_options &opts, const std::string &program, double seconds,
+                                  std::uint64_t samples, std::uint64_t rays)
 {
-    hit_record rec;
-
-    // If we've exceeded the ray bound limit, no more light is gathered.
-    if (depth <= 0)
-        return color(0, 0, 0);
-
-    // The 0.001 threshold eliminates shadow acne when bounces occur at t not exactly 0.
-    // This imprecision comes from floating point limitations.  Applying a tolerance fixes
-    // the issue.
-    if (world.hit(r, 0.001, infinity, rec))
-    {
-        ray   scattered{{0, 0, 0}, {1, 0, 0}};
-        color attenuation{0, 0, 0};
-        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-            return attenuation * ray_color(scattered, world, depth - 1);
-        return color{0, 0, 0};
-
-        // Scattering is determined by material and no longer global here.
-    }
-    vec3 unit_direction = unit_vector(r.direction());
-    auto t              = 0.5 * (unit_direction.y() + 1.0);
-    return (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
-}
-
-hittable_list random_scene()
-{
-    hittable_list world{};
-
-    auto ground_material = std::make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
-
-    for (int a = -11; a < 11; a++)
-    {
-        for (int b = -11; b < 11; b++)
-        {
-            auto   choose_mat = random_double();
-            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9)
-            {
-                std::shared_ptr<material> sphere_material = nullptr;
-
-                if (choose_mat < 0.8)
-                {
-                    // diffuse
-                    auto albedo     = color::random() * color::random();
-                    sphere_material = std::make_shared<lambertian>(albedo);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else if (choose_mat < 0.95)
-                {
-                    // metal
-                    auto albedo     = color::random(0.5, 1);
-                    auto fuzz       = random_double(0, 0.5);
-                    sphere_material = std::make_shared<metal>(albedo, fuzz);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else
-                {
-                    // glass
-                    sphere_material = std::make_shared<dielectric>(1.5);
-                    world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
-        }
-    }
-
-    auto material1 = std::make_shared<dielectric>(1.5);
-    world.add(std::make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = std::make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(std::make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = std::make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(std::make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-    return world;
+    std::string scene = opts.generate       ? "generated:" + std::to_string(opts.generator.spheres)
+                        : opts.scene.empty() ? std::string("random")
+                                             : std::filesystem::path(opts.scene).filename().string();
+    bench_result r;
+    r.name       = "render/" + scene + "/" + std::to_string(opts.width) + "x" + std::to_string(opts.height) +
+             "/spp:" + std::to_string(opts.samples) + "/threads:" + std::to_string(opts.threads);
+    r.iterations = 1;
+    r.ns_per_op  = seconds * 1.0e9;
+    r.min_ns     = r.ns_per_op;
+    r.max_ns     = r.ns_per_op;
+    r.counters   = {{"samples_per_second", static_cast<double>(samples) / seconds},
+                    {"rays_per_second", static_cast<double>(rays) / seconds}};
+    return append_history(opts.history, program, {r}, std::cerr);
 }
 
 int main(int argc, char **argv)
@@ -108,51 +61,224 @@ int main(int argc, char **argv)
     //              << baseline_png_VERSION_MINOR << std::endl;
     //    std::cout << "Usage: " << argv[0] << " number" << std::endl;
 
-    // Image
+    render_options opts;
+    if (!parse_options(argc, argv, opts, std::cerr))
+    {
+        print_usage(std::cerr, argv[0]);
+        return 1;
+    }
+    if (opts.help)
+    {
+        print_usage(std::cout, argv[0]);
+        return 0;
+    }
 
-    const auto aspect_ratio      = 3.0 / 2.0;
-    const int  image_width       = 1200;
-    const int  image_height      = static_cast<int>(image_width / aspect_ratio);
-    const int  samples_per_pixel = 500;
-    const int  max_depth         = 50;
+    if (!opts.trace.empty())
+        tracer.start();
+    if (opts.perf)
+        perf_counters.enable();
 
     // World
 
-    auto world = random_scene();
+    // The built-in scene is the random spheres above and --spheres generates
+    // a larger field like it; --scene loads a text or binary scene file,
+    // possibly along with its camera and image settings.
+    allocation_phases allocations;
+    loaded_scene      loaded;
+    const auto       &sc = loaded.description;
+    trace_span        setup("scene", "setup");
+    perf_scope        setup_counters(perf_phase::scene);
+    if (opts.generate)
+    {
+        auto start = std::chrono::steady_clock::now();
+        generate_scene(opts.generator, loaded.description, opts.threads);
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cerr << "Generated " << sc.spheres.size() << " spheres in " << seconds * 1000.0 << " ms.\n";
+    }
+    else if (opts.scene.empty())
+    {
+        loaded.description = random_scene();
+    }
+    else
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (!load_scene(opts.scene, loaded, std::cerr))
+            return 1;
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        auto mb      = static_cast<double>(std::filesystem::file_size(opts.scene)) / 1.0e6;
+        auto count   = loaded.mapping.is_open() ? loaded.mapping.header().sphere_count : sc.spheres.size();
+        std::cerr << "Loaded " << count << " spheres (" << mb << " MB) from " << opts.scene << " in "
+                  << seconds * 1000.0 << " ms.\n";
+    }
+    setup_counters.end();
+    setup.end();
+    allocations.report(std::cerr, "scene construction");
+
+    // Binary scenes come with their BVH.
+    trace_span indexing("BVH build", "setup");
+    perf_scope indexing_counters(perf_phase::bvh);
+    if (!loaded.mapping.is_open())
+        index_scene(loaded, opts.bvh_cache, std::cerr);
+    indexing_counters.end();
+    indexing.end();
+    allocations.report(std::cerr, "BVH build");
+    const hittable &world = loaded.world;
 
-    // Camera
+    // Image
+
+    resolve_image_settings(opts, sc);
+
+    const int  image_width       = opts.width;
+    const int  image_height      = opts.height;
+    const auto aspect_ratio      = static_cast<double>(image_width) / image_height;
+    const int  samples_per_pixel = opts.samples;
+    const int  max_depth         = opts.max_depth;
 
-    point3 lookfrom(13, 2, 3);
-    point3 lookat(0, 0, 0);
-    vec3   vup(0, 1, 0);
-    auto   dist_to_focus = 10.0;
-    auto   aperture      = 0.1;
+    render_settings settings{image_width, image_height, samples_per_pixel, max_depth};
 
-    camera cam(lookfrom, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus);
+    // Camera
+
+    const auto &view = sc.camera;
+    camera      cam(view.lookfrom, view.lookat, view.vup, view.vfov, aspect_ratio, view.aperture, view.focus_dist);
 
     // Render
 
-    std::cout << "P3\n"
-              << image_width << ' ' << image_height << "\n255\n";
+    // Only the pixels in the region are traced.  For a partial render the
+    // image written is the region's bounding box, and pixels inside it but
+    // outside the region are left black for ppm_merge to skip.
+    auto region = make_region(opts, image_width, image_height);
+    if (region.empty())
+    {
+        std::cerr << "Nothing to render: the requested region lies outside the "
+                  << image_width << 'x' << image_height << " image.\n";
+        return 1;
+    }
+    auto bounds = region.bounds();
+
+    std::vector<std::string> comments;
+    if (!region.full())
+        comments = region_comments(region);
+
+    // --heatmap measures every pixel into this alongside the image.
+    std::optional<cost_map> costs;
+    if (!opts.heatmap.empty())
+        settings.costs = &costs.emplace(opts.heatmap_metric, bounds);
+
+    tonemap tone(opts.curve, opts.exposure);
+
+    std::vector<camera_key> camera_path;
+    if (!opts.animate.empty() && !read_camera_path(opts.animate, camera_path, std::cerr))
+        return 1;
+
+    // Progress, ray rates and how busy the workers are, on the terminal and
+    // optionally as JSON lines for monitoring.
+    metrics_output metrics_json;
+    if (!opts.metrics.empty() && !metrics_json.open(opts.metrics, std::cerr))
+        return 1;
+    int              frames = camera_path.empty() ? 1 : camera_path.back().frame - camera_path.front().frame + 1;
+    auto             total  = region.pixel_count() * static_cast<std::uint64_t>(samples_per_pixel) * static_cast<std::uint64_t>(frames);
+    metrics_reporter metrics(total, opts.threads, opts.metrics_interval, &std::cerr, opts.metrics.empty() ? nullptr : &metrics_json);
+    trace_span       rendering("render", "render");
+    auto             render_start = std::chrono::steady_clock::now();
+    auto             record_run   = [&]()
+    {
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - render_start).count();
+        return opts.history.empty() ||
+               append_render_history(opts, argv[0], seconds, total, read_metrics(opts.threads).rays());
+    };
+
+    // Mapped output is written by the workers themselves.  Everything else is
+    // encoded to standard output, or to an --output file that a writer thread
+    // fills in the background.
+    mapped_p6    mapped;
+    async_file   file;
+    std::ostream out(std::cout.rdbuf());
+    if (opts.mmap)
+    {
+        if (!mapped.open(opts.output, bounds.width(), bounds.height(), comments, std::cerr))
+            return 1;
+    }
+    else if (!opts.output.empty())
+    {
+        if (!file.open(opts.output, std::cerr))
+            return 1;
+        out.rdbuf(&file);
+    }
+
+    if (opts.mmap)
+    {
+        // Workers tone-map finished tiles directly into the mapped file.
+        render_tiles(cam, world, settings, region, opts.tile_size, opts.threads,
+                     [&mapped, &tone, bounds](const pixel_rect &tile, const framebuffer &pixels)
+                     { mapped.write_tile(tile.x0 - bounds.x0, tile.y0 - bounds.y0, pixels, tone); });
+    }
+    else if (!camera_path.empty())
+    {
+        // The world stays resident while every frame is rendered and streamed.
+        render_animation(world, settings, region, camera_path, opts.tile_size, opts.threads, out, opts.format, opts.fps, tone);
+    }
+    else if (opts.max_memory != 0)
+    {
+        // Strips are rendered, encoded and their buffers reused in turn.
+        if (!render_strips(cam, world, settings, region, opts.tile_size, opts.threads, opts.max_memory, out, opts.format, comments, tone))
+            return 1;
+    }
+    else if (opts.stream)
+    {
+        // Rows leave in scanline order while later rows are still rendering.
+        render_rows_ordered(cam, world, settings, region, opts.threads, opts.window, out, opts.format, comments, tone);
+    }
+    else
+    {
+        framebuffer image(bounds.width(), bounds.height());
+        render_tiles(cam, world, settings, region, opts.tile_size, opts.threads, framebuffer_sink(image, bounds));
+        metrics.stop();
+        rendering.end();
+        allocations.report(std::cerr, "render");
+
+        trace_span encoding("encode", "output");
+        perf_scope encoding_counters(perf_phase::output);
+        write_image(out, image, opts.format, comments, tone, opts.threads);
+    }
+    metrics.stop();
+    rendering.end();
 
-    for (int j = image_height - 1; j >= 0; --j)
+    if (!out)
+    {
+        std::cerr << "Could not write " << (opts.output.empty() ? "standard output" : opts.output) << '\n';
+        return 1;
+    }
+    if (opts.mmap)
     {
-        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-        for (int i = 0; i < image_width; ++i)
+        trace_span closing("close output", "io");
+        if (!mapped.close())
         {
-            color pixel_color(0, 0, 0);
-            for (int s = 0; s < samples_per_pixel; ++s)
-            {
-                auto u = (i + random_double()) / (image_width - 1);
-                auto v = (j + random_double()) / (image_height - 1);
-                ray  r = cam.get_ray(u, v);
-                pixel_color += ray_color(r, world, max_depth);
-            }
-            write_color(std::cout, pixel_color, samples_per_pixel);
+            std::cerr << "Could not write " << opts.output << '\n';
+            return 1;
         }
+        closing.end();
     }
-
-    std::cerr << "\nDone.\n";
+    else if (!opts.output.empty())
+    {
+        trace_span closing("close output", "io");
+        if (!file.close(std::cerr))
+            return 1;
+        closing.end();
+        file.report(std::cerr);
+    }
+    allocations.report(std::cerr, !opts.mmap && camera_path.empty() && opts.max_memory == 0 && !opts.stream ? "output" : "render and output");
+    if (!check_hot_path(std::cerr))
+        return 1;
+    if (costs && !costs->write(opts.heatmap, std::cerr))
+        return 1;
+    if (!opts.trace.empty() && !tracer.write(opts.trace, std::cerr))
+        return 1;
+    report_traversal_stats(std::cerr);
+    perf_counters.print(std::cerr, read_metrics(opts.threads).rays());
+    if (!record_run())
+        return 1;
+
+    std::cerr << "Done.\n";
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,122 @@
+#ifndef MAPPED_IMAGE_H
+#define MAPPED_IMAGE_H
+
+#include "framebuffer.h"
+#include "ppm.h"
+#include "region.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define RT_HAVE_MMAP 1
+#else
+#define RT_HAVE_MMAP 0
+#endif
+
+// A binary P6 file mapped into memory.  The header has a fixed size and every
+// pixel is 3 bytes, so each pixel has a known offset and render workers can
+// write finished tiles straight into the page cache.  Nothing is buffered in
+// the process and the kernel writes pages back as tiles complete.
+
+class mapped_p6
+{
+  public:
+    mapped_p6() {}
+    mapped_p6(const mapped_p6 &)            = delete;
+    mapped_p6 &operator=(const mapped_p6 &) = delete;
+    ~mapped_p6() { close(); }
+
+    // Create (or truncate) path, size it for a width x height image and map
+    // it.  Returns false and reports on err if any step fails.
+    bool open(const std::string &path, int width, int height, const std::vector<std::string> &comments, std::ostream &err)
+    {
+#if RT_HAVE_MMAP
+        std::ostringstream header;
+        write_ppm_header(header, "P6", width, height, comments);
+        auto text = header.str();
+
+        image_width  = width;
+        header_bytes = text.size();
+        file_bytes   = header_bytes + static_cast<std::size_t>(width) * height * 3;
+
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return fail("open", path, err);
+        if (::ftruncate(fd, static_cast<off_t>(file_bytes)) != 0)
+            return fail("ftruncate", path, err);
+
+        void *addr = ::mmap(nullptr, file_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED)
+            return fail("mmap", path, err);
+        base = static_cast<std::uint8_t *>(addr);
+
+        std::memcpy(base, text.data(), header_bytes);
+        return true;
+#else
+        err << "Memory-mapped output is not supported on this platform\n";
+        return false;
+#endif
+    }
+
+    // Tone-map a finished tile into the mapping.  (x0, y0) is the tile's
+    // position within the mapped image.  Tiles never overlap, so workers call
+    // this concurrently without locking.
+    void write_tile(int x0, int y0, const framebuffer &pixels, const tonemap &tone)
+    {
+        for (int y = 0; y < pixels.height(); ++y)
+            tone.apply(pixels.row(y), row(y0 + y) + x0 * 3, static_cast<std::size_t>(pixels.width()) * 3);
+
+#if RT_HAVE_MMAP
+        // Start writeback of the rows just touched; MS_ASYNC returns at once.
+        auto page  = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        auto first = static_cast<std::size_t>(row(y0) - base) / page * page;
+        auto last  = static_cast<std::size_t>(row(y0 + pixels.height()) - base);
+        ::msync(base + first, last - first, MS_ASYNC);
+#endif
+    }
+
+    bool close()
+    {
+        bool ok = true;
+#if RT_HAVE_MMAP
+        if (base != nullptr)
+        {
+            ok   = ::munmap(base, file_bytes) == 0;
+            base = nullptr;
+        }
+        if (fd >= 0)
+        {
+            ok = ::close(fd) == 0 && ok;
+            fd = -1;
+        }
+#endif
+        return ok;
+    }
+
+  private:
+    std::uint8_t *row(int y) { return base + header_bytes + static_cast<std::size_t>(y) * image_width * 3; }
+
+    bool fail(const char *what, const std::string &path, std::ostream &err)
+    {
+        err << "Cannot map " << path << ": " << what << " failed: " << std::strerror(errno) << '\n';
+        close();
+        return false;
+    }
+
+    int           fd           = -1;
+    std::uint8_t *base         = nullptr;
+    int           image_width  = 0;
+    std::size_t   header_bytes = 0;
+    std::size_t   file_bytes   = 0;
+};
+
+#endif
@@ -0,0 +1,414 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if __has_include(<sys/socket.h>)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define RT_HAVE_UNIX_SOCKETS 1
+#else
+#define RT_HAVE_UNIX_SOCKETS 0
+#endif
+
+// Render metrics: rays, intersection tests and samples counted as they are
+// traced, so long renders can be watched.
+//
+// Each render worker counts into a slot of its own, padded to a cache line so
+// workers never share one.  Only the owner writes a slot, so an update is a
+// relaxed load and store, which compiles to a plain add yet may be read at any
+// time by the reporter thread.  Workers beyond the last slot, and threads that
+// are not workers, share a slot and add with fetch_add.  The reporter prints a
+// status line at a fixed interval and can send the same figures as JSON lines
+// to a file or a Unix socket for monitoring to scrape.
+
+struct alignas(64) thread_metrics
+{
+    std::atomic<std::uint64_t> primary_rays{0};
+    std::atomic<std::uint64_t> secondary_rays{0};
+    std::atomic<std::uint64_t> intersection_tests{0};
+    std::atomic<std::uint64_t> samples{0};
+    std::atomic<std::uint64_t> busy_ns{0};
+};
+
+// One slot per render worker, and a last one shared by any other thread that
+// traces rays.  Workers numbered metrics_slot_count - 2 and up share the last
+// but one.
+const int             metrics_slot_count = 257;
+inline thread_metrics worker_metrics[metrics_slot_count];
+
+inline thread_local thread_metrics *this_thread_metrics        = &worker_metrics[metrics_slot_count - 1];
+inline thread_local bool            this_thread_shares_metrics = true;
+
+// Add n to a counter in the calling thread's slot.
+inline void metrics_add(std::atomic<std::uint64_t> &counter, std::uint64_t n)
+{
+    if (this_thread_shares_metrics)
+        counter.fetch_add(n, std::memory_order_relaxed);
+    else
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// Makes the calling thread count as render worker index while it exists.
+class metrics_worker
+{
+  public:
+    explicit metrics_worker(int index)
+    {
+        this_thread_metrics        = &worker_metrics[std::min(index, metrics_slot_count - 2)];
+        this_thread_shares_metrics = index >= metrics_slot_count - 2;
+    }
+    ~metrics_worker()
+    {
+        this_thread_metrics        = &worker_metrics[metrics_slot_count - 1];
+        this_thread_shares_metrics = true;
+    }
+};
+
+// Adds the time it exists to the calling thread's busy time.  Workers hold
+// one per tile or row, so the time they spend waiting for work, or for the
+// writer, counts as idle.
+class metrics_busy
+{
+  public:
+    metrics_busy() : start{std::chrono::steady_clock::now()} {}
+    ~metrics_busy()
+    {
+        auto busy = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        metrics_add(this_thread_metrics->busy_ns, static_cast<std::uint64_t>(busy.count()));
+    }
+
+  private:
+    std::chrono::steady_clock::time_point start;
+};
+
+struct metrics_snapshot
+{
+    double                     seconds            = 0;
+    std::uint64_t              primary_rays       = 0;
+    std::uint64_t              secondary_rays     = 0;
+    std::uint64_t              intersection_tests = 0;
+    std::uint64_t              samples            = 0;
+    std::vector<std::uint64_t> busy_ns;
+
+    std::uint64_t rays() const { return primary_rays + secondary_rays; }
+};
+
+// The counts of every slot, and the busy time of the first thread_count.
+inline metrics_snapshot read_metrics(int thread_count)
+{
+    metrics_snapshot s;
+    s.busy_ns.resize(static_cast<std::size_t>(std::min(thread_count, metrics_slot_count - 1)));
+    for (int i = 0; i < metrics_slot_count; ++i)
+    {
+        const auto &m = worker_metrics[i];
+        s.primary_rays += m.primary_rays.load(std::memory_order_relaxed);
+        s.secondary_rays += m.secondary_rays.load(std::memory_order_relaxed);
+        s.intersection_tests += m.intersection_tests.load(std::memory_order_relaxed);
+        s.samples += m.samples.load(std::memory_order_relaxed);
+        if (static_cast<std::size_t>(i) < s.busy_ns.size())
+            s.busy_ns[i] = m.busy_ns.load(std::memory_order_relaxed);
+    }
+    return s;
+}
+
+// The single line of status on the terminal, rewritten in place.  Closing it
+// ends the line, so whatever is printed next starts on a fresh one, and
+// suppresses further updates.
+class status_line
+{
+  public:
+    void show(std::ostream &out, const std::string &text)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closed)
+            return;
+        out << '\r' << text << "   " << std::flush;
+        showing = true;
+    }
+
+    void close(std::ostream &out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (showing)
+            out << '\n';
+        showing = false;
+        closed  = true;
+    }
+
+  private:
+    std::mutex mutex;
+    bool       showing = false;
+    bool       closed  = false;
+};
+
+inline status_line render_status;
+
+// Where JSON lines go: a file, or a Unix stream socket given as unix:path.
+// A monitor that goes away only stops the lines; the render carries on.
+class metrics_output
+{
+  public:
+    metrics_output() {}
+    metrics_output(const metrics_output &)            = delete;
+    metrics_output &operator=(const metrics_output &) = delete;
+    ~metrics_output()
+    {
+#if RT_HAVE_UNIX_SOCKETS
+        if (socket_fd >= 0)
+            ::close(socket_fd);
+#endif
+    }
+
+    // Returns false, after reporting the problem on err, if destination
+    // cannot be opened.
+    bool open(const std::string &destination, std::ostream &err)
+    {
+        const std::string prefix = "unix:";
+        if (destination.compare(0, prefix.size(), prefix) != 0)
+        {
+            file.open(destination, std::ios::trunc);
+            if (!file)
+            {
+                err << "Cannot open metrics file " << destination << '\n';
+                return false;
+            }
+            return true;
+        }
+
+#if RT_HAVE_UNIX_SOCKETS
+        auto        path = destination.substr(prefix.size());
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path))
+        {
+            err << "Bad metrics socket path '" << path << "'\n";
+            return false;
+        }
+        path.copy(address.sun_path, path.size());
+        socket_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socket_fd < 0 || ::connect(socket_fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0)
+        {
+            err << "Cannot connect to metrics socket " << path << '\n';
+            return false;
+        }
+        return true;
+#else
+        err << "Unix sockets are not available on this platform\n";
+        return false;
+#endif
+    }
+
+    void write_line(const std::string &line)
+    {
+        if (file.is_open())
+        {
+            file << line << '\n' << std::flush;
+            return;
+        }
+#if RT_HAVE_UNIX_SOCKETS
+        if (socket_fd < 0)
+            return;
+        auto text = line + '\n';
+#ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL;
+#else
+        const int flags = 0;
+#endif
+        for (std::size_t sent = 0; sent < text.size();)
+        {
+            auto n = ::send(socket_fd, text.data() + sent, text.size() - sent, flags);
+            if (n <= 0)
+            {
+                ::close(socket_fd);
+                socket_fd = -1;
+                return;
+            }
+            sent += static_cast<std::size_t>(n);
+        }
+#endif
+    }
+
+  private:
+    std::ofstream file;
+#if RT_HAVE_UNIX_SOCKETS
+    int socket_fd = -1;
+#endif
+};
+
+// "1h02m", "3m20s" or "12s".
+inline std::string format_duration(double seconds)
+{
+    auto               s = static_cast<long long>(seconds + 0.5);
+    std::ostringstream text;
+    if (s >= 3600)
+        text << s / 3600 << 'h' << (s / 60 % 60 < 10 ? "0" : "") << s / 60 % 60 << 'm';
+    else if (s >= 60)
+        text << s / 60 << 'm' << (s % 60 < 10 ? "0" : "") << s % 60 << 's';
+    else
+        text << s << 's';
+    return text.str();
+}
+
+// Reports progress from its own thread every interval until stopped: a
+// status line with the progress, ray and sample rates over the last interval,
+// how busy the workers were and the time left, and optionally a JSON line of
+// the same.  total_samples is what the whole run will trace, for the
+// progress and time left.
+class metrics_reporter
+{
+  public:
+    metrics_reporter(std::uint64_t total_samples, int thread_count, double interval_seconds, std::ostream *status,
+                     metrics_output *json)
+        : total{total_samples}, threads{thread_count}, interval{interval_seconds}, status_out{status}, json_out{json},
+          start{std::chrono::steady_clock::now()}, first{read_metrics(thread_count)}, last{first}
+    {
+        reporter = std::thread([this]() { run(); });
+    }
+
+    metrics_reporter(const metrics_reporter &)            = delete;
+    metrics_reporter &operator=(const metrics_reporter &) = delete;
+    ~metrics_reporter() { stop(); }
+
+    // Stop reporting, close the status line and print a summary of the
+    // whole run.  Further calls do nothing.
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping)
+                return;
+            stopping = true;
+        }
+        wake.notify_one();
+        reporter.join();
+
+        auto now = sample();
+        if (json_out != nullptr)
+            json_out->write_line(json(now, first, true));
+        if (status_out == nullptr)
+            return;
+        render_status.close(*status_out);
+        auto               rays = now.rays() - first.rays();
+        std::ostringstream summary;
+        summary << "Traced " << rays << " rays (" << now.primary_rays - first.primary_rays << " primary, "
+                << now.secondary_rays - first.secondary_rays << " secondary) and "
+                << now.intersection_tests - first.intersection_tests << " intersection tests in " << std::fixed
+                << std::setprecision(2) << now.seconds << " s: " << static_cast<double>(rays) / now.seconds / 1.0e6
+                << " Mrays/s, workers " << std::setprecision(0) << 100.0 * utilization(now, first) << "% busy.\n";
+        *status_out << summary.str();
+    }
+
+  private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!wake.wait_for(lock, std::chrono::duration<double>(interval), [this]() { return stopping; }))
+        {
+            auto now = sample();
+            if (status_out != nullptr)
+                render_status.show(*status_out, status(now));
+            if (json_out != nullptr)
+                json_out->write_line(json(now, last, false));
+            last = now;
+        }
+    }
+
+    metrics_snapshot sample() const
+    {
+        auto s    = read_metrics(threads);
+        s.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return s;
+    }
+
+    // Share of the time between the snapshots the workers spent rendering.
+    double utilization(const metrics_snapshot &now, const metrics_snapshot &then) const
+    {
+        double busy = 0;
+        for (std::size_t i = 0; i < now.busy_ns.size(); ++i)
+            busy += static_cast<double>(now.busy_ns[i] - then.busy_ns[i]) * 1.0e-9;
+        auto span = (now.seconds - then.seconds) * static_cast<double>(now.busy_ns.size());
+        return span > 0 ? std::min(1.0, busy / span) : 0.0;
+    }
+
+    double progress(const metrics_snapshot &now) const
+    {
+        return total == 0 ? 0.0 : std::min(1.0, static_cast<double>(now.samples - first.samples) / static_cast<double>(total));
+    }
+
+    // Seconds left at the average rate so far, or negative before any sample
+    // has finished.
+    double eta(const metrics_snapshot &now) const
+    {
+        auto done = now.samples - first.samples;
+        if (done == 0)
+            return -1;
+        return now.seconds * static_cast<double>(total > done ? total - done : 0) / static_cast<double>(done);
+    }
+
+    std::string status(const metrics_snapshot &now) const
+    {
+        auto               span = std::max(now.seconds - last.seconds, 1e-9);
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(1) << 100.0 * progress(now) << "%  " << std::setprecision(2)
+             << static_cast<double>(now.rays() - last.rays()) / span / 1.0e6 << " Mrays/s  "
+             << static_cast<double>(now.samples - last.samples) / span / 1.0e6 << " Msamples/s  "
+             << std::setprecision(0) << 100.0 * utilization(now, last) << "% busy";
+        if (auto left = eta(now); left >= 0)
+            text << "  ETA " << format_duration(left);
+        return text.str();
+    }
+
+    std::string json(const metrics_snapshot &now, const metrics_snapshot &then, bool done) const
+    {
+        auto               span = std::max(now.seconds - then.seconds, 1e-9);
+        auto               left = eta(now);
+        std::ostringstream line;
+        line << "{\"elapsed_s\":" << now.seconds << ",\"progress\":" << progress(now) << ",\"eta_s\":";
+        if (left >= 0)
+            line << left;
+        else
+            line << "null";
+        line << ",\"samples\":" << now.samples - first.samples << ",\"primary_rays\":" << now.primary_rays - first.primary_rays
+             << ",\"secondary_rays\":" << now.secondary_rays - first.secondary_rays
+             << ",\"intersection_tests\":" << now.intersection_tests - first.intersection_tests
+             << ",\"rays_per_s\":" << static_cast<double>(now.rays() - then.rays()) / span
+             << ",\"samples_per_s\":" << static_cast<double>(now.samples - then.samples) / span
+             << ",\"thread_utilization\":[";
+        for (std::size_t i = 0; i < now.busy_ns.size(); ++i)
+        {
+            auto busy = static_cast<double>(now.busy_ns[i] - then.busy_ns[i]) * 1.0e-9 / span;
+            line << (i == 0 ? "" : ",") << std::min(1.0, busy);
+        }
+        line << "],\"done\":" << (done ? "true" : "false") << '}';
+        return line.str();
+    }
+
+    std::uint64_t                         total;
+    int                                   threads;
+    double                                interval;
+    std::ostream                         *status_out;
+    metrics_output                       *json_out;
+    std::chrono::steady_clock::time_point start;
+    metrics_snapshot                      first;
+    metrics_snapshot                      last;
+    std::mutex                            mutex;
+    std::condition_variable               wake;
+    bool                                  stopping = false;
+    std::thread                           reporter;
+};
+
+#endif
@@ -0,0 +1,586 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include "framebuffer.h"
+#include "heatmap.h"
+#include "region.h"
+#include "scene_file.h"
+#include "scene_generator.h"
+#include "tonemap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+inline int default_thread_count()
+{
+    auto n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : static_cast<int>(n);
+}
+
+// Inclusive ranges of tile numbers, as given to --tiles.
+using tile_ranges = std::vector<std::pair<int, int>>;
+
+// Command line settings for the renderer.  Everything has a default, so
+// running the program without arguments renders the full final scene.  The
+// image settings left at 0 here come from the scene file, if it has them, or
+// their defaults; see resolve_image_settings.
+
+struct render_options
+{
+    std::string        scene            = {};
+    std::string        bvh_cache        = {};
+    bool               generate         = false;
+    generator_settings generator        = {};
+    int                width            = 0;
+    int                height           = 0;
+    int                samples          = 0;
+    int                max_depth        = 0;
+    bool               crop_set         = false;
+    pixel_rect         crop             = {};
+    tile_ranges        tiles            = {};
+    int                tile_size        = 32;
+    image_format       format           = image_format::P3;
+    transfer_curve     curve            = transfer_curve::gamma2;
+    double             exposure         = 0.0;
+    std::string        output           = {};
+    bool               mmap             = false;
+    bool               stream           = false;
+    int                window           = 0;
+    std::size_t        max_memory       = 0;
+    std::string        animate          = {};
+    int                fps              = 24;
+    std::string        metrics          = {};
+    double             metrics_interval = 1.0;
+    std::string        heatmap          = {};
+    cost_metric        heatmap_metric   = cost_metric::time;
+    std::string        trace            = {};
+    bool               perf             = false;
+    std::string        history          = {};
+    int                threads          = default_thread_count();
+    bool               help             = false;
+};
+
+inline void print_usage(std::ostream &out, const char *program)
+{
+    out << "Usage: " << program << " [options] > image.ppm\n"
+        << "\n"
+        << "  --scene file         render the scene in a text or binary (scene_compile)\n"
+        << "                       scene file instead of the built-in random spheres\n"
+        << "  --spheres n          render a generated field of about n spheres (1e7 is\n"
+        << "                       fine) instead of the built-in random spheres\n"
+        << "  --density d          generated spheres per unit of ground area (default 1,\n"
+        << "                       at most 4.9)\n"
+        << "  --material-mix d,m,g relative shares of diffuse, metal and glass generated\n"
+        << "                       spheres (default 0.8,0.15,0.05)\n"
+        << "  --seed n             seed of the generated field (default 0)\n"
+        << "  --bvh-cache dir      keep the BVHs built for the built-in, generated and\n"
+        << "                       text scenes in dir and reuse them while the spheres\n"
+        << "                       are unchanged\n"
+        << "  --width n            image width in pixels (default: the scene's, or 1200)\n"
+        << "  --height n           image height in pixels (default: the scene's aspect\n"
+        << "                       ratio, or width / 1.5)\n"
+        << "  --samples n          samples per pixel (default: the scene's, or 500)\n"
+        << "  --max-depth n        ray bounce limit (default: the scene's, or 50)\n"
+        << "  --format f           p3 (text PPM, default), p6 (binary PPM), pfm (float),\n"
+        << "                       png or qoi; y4m or rgb (raw frames) with --animate\n"
+        << "  --curve c            transfer curve for 8-bit formats: gamma2 (default) or\n"
+        << "                       srgb\n"
+        << "  --exposure stops     scale the image by 2^stops before the curve (default 0)\n"
+        << "  --output file        write the image to file instead of standard output;\n"
+        << "                       a background thread does the disk writes, bypassing\n"
+        << "                       the page cache where O_DIRECT is supported\n"
+        << "  --mmap               map the --output file and have workers write P6 pixels\n"
+        << "                       straight into it (requires --format p6)\n"
+        << "  --stream             write rows in scanline order as soon as they finish\n"
+        << "                       instead of after the whole frame (not pfm)\n"
+        << "  --window n           rows --stream may hold in memory (default 4 per thread)\n"
+        << "  --max-memory size    render in strips, holding at most size bytes of image\n"
+        << "                       at once (suffix K, M or G); for images too large to\n"
+        << "                       keep in memory (not pfm)\n"
+        << "  --animate path       render every frame of a camera path file and stream\n"
+        << "                       them as one video (requires --format y4m or rgb)\n"
+        << "  --fps n              frame rate recorded in a y4m stream (default 24)\n"
+        << "  --metrics dest       also write progress, ray rates and thread utilization\n"
+        << "                       as JSON lines to a file, or to a Unix socket given\n"
+        << "                       as unix:path\n"
+        << "  --metrics-interval s seconds between progress reports (default 1)\n"
+        << "  --heatmap file       also write what each pixel cost as a false-colour\n"
+        << "                       image (.png, .qoi or .ppm), or as raw costs (.pfm)\n"
+        << "  --heatmap-metric m   cost shown by --heatmap: time (default), tests\n"
+        << "                       (intersection tests) or depth (rays per path)\n"
+        << "  --trace file         record a timeline of scene setup, the BVH build, every\n"
+        << "                       tile, encoding and file writes as Chrome trace-event\n"
+        << "                       JSON for ui.perfetto.dev or chrome://tracing\n"
+        << "  --perf               count cycles, instructions, cache and branch misses\n"
+        << "                       per phase with perf_event_open (Linux) and report\n"
+        << "                       IPC and misses per ray\n"
+        << "  --history file       append the run's time, samples/s and rays/s to a\n"
+        << "                       benchmark history file for bench_compare\n"
+        << "  --threads n          number of render threads (default: all cores)\n"
+        << "  --crop x0,y0,x1,y1   render only the pixels x0 <= x < x1, y0 <= y < y1\n"
+        << "                       (y counts down from the top scanline)\n"
+        << "  --tiles list         render only the listed tiles, e.g. 3,7,12-15\n"
+        << "                       (tiles are numbered row-major from the top left)\n"
+        << "  --tile-size n        tile edge length in pixels (default 32)\n"
+        << "  --help               show this message\n";
+}
+
+// Split "a,b,c" into its comma separated fields.
+inline std::vector<std::string> split_list(const std::string &text)
+{
+    std::vector<std::string> fields;
+    std::stringstream        ss(text);
+    std::string              field;
+    while (std::getline(ss, field, ','))
+        fields.push_back(field);
+    return fields;
+}
+
+inline bool parse_int(const std::string &text, int &value)
+{
+    try
+    {
+        std::size_t used = 0;
+        value            = std::stoi(text, &used);
+        return used == text.size();
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+inline bool parse_crop(const std::string &text, pixel_rect &rect)
+{
+    auto fields = split_list(text);
+    if (fields.size() != 4)
+        return false;
+    return parse_int(fields[0], rect.x0) && parse_int(fields[1], rect.y0) &&
+           parse_int(fields[2], rect.x1) && parse_int(fields[3], rect.y1) && !rect.empty();
+}
+
+inline bool parse_double(const std::string &text, double &value)
+{
+    try
+    {
+        std::size_t used = 0;
+        value            = std::stod(text, &used);
+        return used == text.size() && std::isfinite(value);
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+// A byte count with an optional K, M or G (binary) suffix: "512M".
+inline bool parse_size(const std::string &text, std::size_t &bytes)
+{
+    if (text.empty())
+        return false;
+
+    std::size_t scale  = 1;
+    std::string digits = text;
+    switch (text.back())
+    {
+        case 'K':
+        case 'k':
+            scale = std::size_t{1} << 10;
+            break;
+        case 'M':
+        case 'm':
+            scale = std::size_t{1} << 20;
+            break;
+        case 'G':
+        case 'g':
+            scale = std::size_t{1} << 30;
+            break;
+        default:
+            break;
+    }
+    if (scale != 1)
+        digits.pop_back();
+
+    try
+    {
+        std::size_t used  = 0;
+        auto        value = std::stoull(digits, &used);
+        bytes             = static_cast<std::size_t>(value) * scale;
+        return used == digits.size() && bytes > 0;
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+// Accepts single tile numbers and inclusive ranges: "3,7,12-15".  The ranges
+// are kept as given; make_region limits them to the tiles the image has.
+inline bool parse_tiles(const std::string &text, tile_ranges &tiles)
+{
+    for (const auto &field : split_list(text))
+    {
+        auto dash  = field.find('-', 1);
+        int  first = 0;
+        int  last  = 0;
+        if (dash == std::string::npos)
+        {
+            if (!parse_int(field, first))
+                return false;
+            last = first;
+        }
+        else if (!parse_int(field.substr(0, dash), first) || !parse_int(field.substr(dash + 1), last))
+        {
+            return false;
+        }
+
+        if (first < 0 || last < first)
+            return false;
+        tiles.emplace_back(first, last);
+    }
+    return !tiles.empty();
+}
+
+// Returns false, after reporting the problem on err, if the command line is
+// malformed.
+inline bool parse_options(int argc, char **argv, render_options &opts, std::ostream &err)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--help" || arg == "-h")
+        {
+            opts.help = true;
+            continue;
+        }
+        if (arg == "--mmap")
+        {
+            opts.mmap = true;
+            continue;
+        }
+        if (arg == "--stream")
+        {
+            opts.stream = true;
+            continue;
+        }
+        if (arg == "--perf")
+        {
+            opts.perf = true;
+            continue;
+        }
+
+        if (i + 1 >= argc)
+        {
+            err << "Missing value for " << arg << '\n';
+            return false;
+        }
+        std::string value = argv[++i];
+
+        if (arg == "--width")
+        {
+            if (!parse_int(value, opts.width) || opts.width <= 1)
+            {
+                err << "Bad --width value '" << value << "'\n";
+                return false;
+            }
+        }
+        else if (arg == "--height")
+        {
+            if (!parse_int(value, opts.height) || opts.height <= 1)
+            {
+                err << "Bad --height value '" << value << "'\n";
+                return false;
+            }
+        }
+        else if (arg == "--scene")
+        {
+            opts.scene = value;
+        }
+        else if (arg == "--spheres")
+        {
+            double n = 0;
+            if (!parse_double(value, n) || n < 1 || n > 1e9 || n != std::floor(n))
+            {
+                err << "Bad --spheres value '" << value << "'\n";
+                return false;
+            }
+            opts.generate          = true;
+            opts.generator.spheres = static_cast<std::size_t>(n);
+        }
+        else if (arg == "--density")
+        {
+            auto &d = opts.generator.density;
+            if (!parse_double(value, d) || d <= 0 || d > max_generated_density())
+            {
+                err << "Bad --density value '" << value << "', expected more than 0 and at most "
+                    << max_generated_density() << '\n';
+                return false;
+            }
+        }
+        else if (arg == "--material-mix")
+        {
+            auto  fields = split_list(value);
+            auto &mix    = opts.generator.mix;
+            if (fields.size() != 3 || !parse_double(fields[0], mix[0]) || !parse_double(fields[1], mix[1]) ||
+                !parse_double(fields[2], mix[2]) || mix[0] < 0 || mix[1] < 0 || mix[2] < 0 ||
+                mix[0] + mix[1] + mix[2] <= 0)
+            {
+                err << "Bad --material-mix value '" << value << "', expected diffuse,metal,glass shares\n";
+                return false;
+            }
+        }
+        else if (arg == "--seed")
+        {
+            try
+            {
+                std::size_t used    = 0;
+                opts.generator.seed = std::stoull(value, &used);
+                if (used != value.size())
+                    throw std::invalid_argument(value);
+            }
+            catch (const std::exception &)
+            {
+                err << "Bad --seed value '" << value << "'\n";
+                return false;
+            }
+        }
+        else if (arg == "--metrics")
+        {
+            opts.metrics = value;
+        }
+        else if (arg == "--metrics-interval")
+        {
+            if (!parse_double(value, opts.metrics_interval) || opts.metrics_interval <= 0)
+            {
+                err << "Bad --metrics-interval value '" << value << "'\n";
+                return false;
+            }
+        }
+        else if (arg == "--heatmap")
+        {
+            opts.heatmap = value;
+        }
+        else if (arg == "--heatmap-metric")
+        {
+            if (!parse_cost_metric(value, opts.heatmap_metric))
+            {
+                err << "Bad --heatmap-metric value '" << value << "', expected time, tests or depth\n";
+                return false;
+            }
+        }
+        else if (arg == "--trace")
+        {
+            opts.trace = value;
+        }
+        else if (arg == "--history")
+        {
+            opts.history = value;
+        }
+        else if (arg == "--bvh-cache")
+        {
+            opts.bvh_cache = value;
+        }
+        else if (arg == "--max-depth")
+        {
+            if (!parse_int(value, opts.max_depth) || opts.max_depth <= 0)
+            {
+                err << "Bad --max-depth value '" << value << "'\n";
+                return false;
+            }
+        }
+        else if (arg == "--samples")
+        {
+            if (!parse_int(value, opts.samples) || opts.samples <= 0)
+            {
+                err << "Bad --samples value '" << value << "'\n";
+                return false;
+            }
+        }
+        else if (arg == "--crop")
+        {
+            if (!parse_crop(value, opts.crop))
+            {
+                err << "Bad --crop value '" << value << "', expected x0,y0,x1,y1\n";
+                return false;
+            }
+            opts.crop_set = true;
+        }
+        else if (arg == "--tiles")
+        {
+            if (!parse_tiles(value, opts.tiles))
+            {
+                err << "Bad --tiles value '" << value << "', expected a list such as 3,7,12-15\n";
+                return false;
+            }
+        }
+        else if (arg == "--format")
+        {
+            if (!parse_image_format(value, opts.format))
+            {
+                err << "Bad --format value '" << value << "', expected p3, p6, pfm, png, qoi, y4m or rgb\n";
+                return false;
+            }
+        }
+        else if (arg == "--curve")
+        {
+            if (!parse_transfer_curve(value, opts.curve))
+            {
+                err << "Bad --curve value '" << value << "', expected gamma2 or srgb\n";
+                return false;
+            }
+        }
+        else if (arg == "--exposure")
+        {
+            if (!parse_double(value, opts.exposure))
+            {
+                err << "Bad --exposure value '" << value << "'\n";
+                return false;
+            }
+        }
+        else if (arg == "--output" || arg == "-o")
+        {
+            opts.output = value;
+        }
+        else if (arg == "--threads")
+        {
+            if (!parse_int(value, opts.threads) || opts.threads <= 0)
+            {
+                err << "Bad --threads value '" << value << "'\n";
+                return false;
+            }
+        }
+        else if (arg == "--window")
+        {
+            if (!parse_int(value, opts.window) || opts.window <= 0)
+            {
+                err << "Bad --window value '" << value << "'\n";
+                return false;
+            }
+        }
+        else if (arg == "--max-memory")
+        {
+            if (!parse_size(value, opts.max_memory))
+            {
+                err << "Bad --max-memory value '" << value << "', expected a size such as 512M\n";
+                return false;
+            }
+        }
+        else if (arg == "--animate")
+        {
+            opts.animate = value;
+        }
+        else if (arg == "--fps")
+        {
+            if (!parse_int(value, opts.fps) || opts.fps <= 0)
+            {
+                err << "Bad --fps value '" << value << "'\n";
+                return false;
+            }
+        }
+        else if (arg == "--tile-size")
+        {
+            if (!parse_int(value, opts.tile_size) || opts.tile_size <= 0)
+            {
+                err << "Bad --tile-size value '" << value << "'\n";
+                return false;
+            }
+        }
+        else
+        {
+            err << "Unknown option " << arg << '\n';
+            return false;
+        }
+    }
+
+    if (opts.generate && !opts.scene.empty())
+    {
+        err << "--spheres cannot be combined with --scene\n";
+        return false;
+    }
+    if (opts.mmap && (opts.output.empty() || opts.format != image_format::P6))
+    {
+        err << "--mmap needs --format p6 and an --output file\n";
+        return false;
+    }
+    if (opts.stream && (opts.mmap || opts.format == image_format::PFM))
+    {
+        err << "--stream cannot write pfm or be combined with --mmap\n";
+        return false;
+    }
+    if (opts.max_memory != 0 && (opts.stream || opts.mmap || opts.format == image_format::PFM))
+    {
+        err << "--max-memory cannot write pfm or be combined with --stream or --mmap\n";
+        return false;
+    }
+    if (opts.animate.empty() == is_video_format(opts.format))
+    {
+        err << "--animate needs --format y4m or rgb, and those formats need --animate\n";
+        return false;
+    }
+    if (!opts.animate.empty() && (opts.stream || opts.mmap || opts.max_memory != 0))
+    {
+        err << "--animate cannot be combined with --stream, --mmap or --max-memory\n";
+        return false;
+    }
+    if (!opts.heatmap.empty() && !opts.animate.empty())
+    {
+        err << "--heatmap cannot be combined with --animate\n";
+        return false;
+    }
+    if (opts.window == 0)
+        opts.window = 4 * opts.threads;
+    return true;
+}
+
+// Fill in the image settings the command line left out, from the scene where
+// it gives them and from the defaults otherwise.  A height not given anywhere
+// keeps the scene's aspect ratio, or 3:2.
+inline void resolve_image_settings(render_options &opts, const scene &s)
+{
+    if (opts.width == 0)
+        opts.width = s.image_width != 0 ? s.image_width : 1200;
+    if (opts.height == 0 && s.image_height != 0)
+    {
+        if (s.image_width == 0 || s.image_width == opts.width)
+            opts.height = s.image_height;
+        else
+            opts.height = std::max(2, static_cast<int>(static_cast<double>(opts.width) * s.image_height / s.image_width));
+    }
+    if (opts.height == 0)
+        opts.height = std::max(2, static_cast<int>(opts.width / (3.0 / 2.0)));
+    if (opts.samples == 0)
+        opts.samples = s.samples_per_pixel != 0 ? s.samples_per_pixel : 500;
+    if (opts.max_depth == 0)
+        opts.max_depth = s.max_depth != 0 ? s.max_depth : 50;
+}
+
+// Turn --crop and --tiles into the set of pixels to render.  Both may be
+// given; the region is then the union of the crop and the tiles.
+inline render_region make_region(const render_options &opts, int image_width, int image_height)
+{
+    render_region region(image_width, image_height);
+    if (!opts.crop_set && opts.tiles.empty())
+        return region;
+
+    std::vector<pixel_rect> rects;
+    if (opts.crop_set)
+        rects.push_back(opts.crop);
+    int tile_count = tiles_across(image_width, opts.tile_size) * tiles_down(image_height, opts.tile_size);
+    for (const auto &[first, last] : opts.tiles)
+    {
+        for (int t = first; t <= std::min(last, tile_count - 1); ++t)
+            rects.push_back(tile_rect(t, image_width, image_height, opts.tile_size));
+    }
+    region.set(rects);
+    return region;
+}
+
+#endif
@@ -0,0 +1,275 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+#if __has_include(<linux/perf_event.h>)
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define RT_HAVE_PERF_EVENTS 1
+#else
+#define RT_HAVE_PERF_EVENTS 0
+#endif
+
+// Hardware counters read through perf_event_open, for judging data layout
+// changes (vec3 padding, hit_record size, BVH node layout) by what they do to
+// the caches rather than by wall time alone.
+//
+// With --perf every thread doing the work of a phase opens its own group of
+// counters around it: the main thread for scene setup and the BVH build,
+// each worker for the render and the encoders and writers for output.  The
+// counts are summed per phase and reported at the end with IPC and misses
+// per ray.  Only user space is counted, which perf_event_paranoid up to 2
+// allows.  Counters the machine lacks, virtual machines often lacking the
+// cache events, are left out; if none open, that is reported once.
+
+enum class perf_phase
+{
+    scene,
+    bvh,
+    render,
+    output,
+    count
+};
+
+const int perf_counter_count = 5;
+
+inline const char *const perf_counter_names[perf_counter_count] = {"cycles", "instructions", "L1D misses",
+                                                                     "LLC misses", "branch misses"};
+
+struct perf_counts
+{
+    std::uint64_t values[perf_counter_count] = {};
+    bool          valid[perf_counter_count]  = {};
+
+    void add(const perf_counts &o)
+    {
+        for (int i = 0; i < perf_counter_count; ++i)
+        {
+            values[i] += o.values[i];
+            valid[i] = valid[i] || o.valid[i];
+        }
+    }
+};
+
+// The counters of the calling thread, as one group so they are scheduled
+// together and their ratios hold even when the kernel multiplexes them.
+class perf_group
+{
+  public:
+    perf_group() {}
+    perf_group(const perf_group &)            = delete;
+    perf_group &operator=(const perf_group &) = delete;
+    ~perf_group() { close(); }
+
+    // Open and start the counters.  Returns false, with errno's text in why,
+    // if not even the cycle counter opens.
+    bool open(std::string &why)
+    {
+#if RT_HAVE_PERF_EVENTS
+        const std::uint32_t types[perf_counter_count] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+                                                         PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE};
+        const std::uint64_t read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        const std::uint64_t configs[perf_counter_count] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                           PERF_COUNT_HW_CACHE_L1D | read_miss,
+                                                           PERF_COUNT_HW_CACHE_LL | read_miss,
+                                                           PERF_COUNT_HW_BRANCH_MISSES};
+        for (int i = 0; i < perf_counter_count; ++i)
+        {
+            perf_event_attr attr{};
+            attr.size           = sizeof(attr);
+            attr.type           = types[i];
+            attr.config         = configs[i];
+            attr.disabled       = fds[0] < 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv     = 1;
+            attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                               PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds[i] = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, fds[0], 0));
+            if (fds[i] >= 0)
+                ::ioctl(fds[i], PERF_EVENT_IOC_ID, &ids[i]);
+            else if (i == 0)
+            {
+                if (errno == ENOENT || errno == EOPNOTSUPP)
+                    why = "this machine has no cycle counter to offer (common in virtual machines)";
+                else if (errno == EACCES || errno == EPERM)
+                    why = "not permitted; kernel.perf_event_paranoid must be 2 or less";
+                else
+                    why = std::strerror(errno);
+                return false;
+            }
+        }
+        ::ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ::ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        return true;
+#else
+        why = "perf_event_open is not available on this platform";
+        return false;
+#endif
+    }
+
+    // The counts so far, scaled up for any time the group was not running.
+    perf_counts read() const
+    {
+        perf_counts c;
+#if RT_HAVE_PERF_EVENTS
+        // nr, time_enabled, time_running, then a value and id per counter.
+        std::uint64_t data[3 + 2 * perf_counter_count] = {};
+        if (fds[0] < 0 || ::read(fds[0], data, sizeof(data)) < static_cast<ssize_t>(3 * sizeof(std::uint64_t)))
+            return c;
+        double scale = data[2] == 0 ? 0.0 : static_cast<double>(data[1]) / static_cast<double>(data[2]);
+        for (std::uint64_t k = 0; k < data[0] && k < perf_counter_count; ++k)
+        {
+            for (int i = 0; i < perf_counter_count; ++i)
+            {
+                if (fds[i] >= 0 && ids[i] == data[4 + 2 * k])
+                {
+                    c.values[i] = static_cast<std::uint64_t>(static_cast<double>(data[3 + 2 * k]) * scale);
+                    c.valid[i]  = true;
+                }
+            }
+        }
+#endif
+        return c;
+    }
+
+    void close()
+    {
+#if RT_HAVE_PERF_EVENTS
+        for (auto &fd : fds)
+        {
+            if (fd >= 0)
+                ::close(fd);
+            fd = -1;
+        }
+#endif
+    }
+
+  private:
+    int           fds[perf_counter_count] = {-1, -1, -1, -1, -1};
+    std::uint64_t ids[perf_counter_count] = {};
+};
+
+// The counts of every phase, summed over the threads that worked on it.
+class perf_report
+{
+  public:
+    void enable() { on.store(true, std::memory_order_relaxed); }
+    bool enabled() const { return on.load(std::memory_order_relaxed); }
+
+    void add(perf_phase phase, const perf_counts &c)
+    {
+        std::lock_guard guard(lock);
+        phases[static_cast<int>(phase)].add(c);
+        measured[static_cast<int>(phase)] = true;
+    }
+
+    // Remember why the counters could not be opened, to report once.
+    void fail(const std::string &why)
+    {
+        std::lock_guard guard(lock);
+        if (failure.empty())
+            failure = why;
+    }
+
+    // Print each phase's counts and IPC, and the render's counts per ray.
+    void print(std::ostream &out, std::uint64_t rays)
+    {
+        if (!enabled())
+            return;
+        std::lock_guard guard(lock);
+        if (!failure.empty())
+        {
+            out << "Hardware counters unavailable: " << failure << ".\n";
+            return;
+        }
+
+        const char *names[] = {"scene setup", "BVH build", "render", "output"};
+        auto        flags   = out.flags();
+        auto        prec    = out.precision();
+        out << std::fixed << std::setprecision(2) << "Hardware counters (user space):\n";
+        for (int p = 0; p < static_cast<int>(perf_phase::count); ++p)
+        {
+            if (!measured[p])
+                continue;
+            const auto &c = phases[p];
+            out << "  " << std::left << std::setw(12) << names[p] << std::right;
+            for (int i = 0; i < perf_counter_count; ++i)
+            {
+                if (c.valid[i])
+                    out << (i == 0 ? " " : ", ") << static_cast<double>(c.values[i]) / 1.0e6 << "M " << perf_counter_names[i];
+            }
+            if (c.valid[0] && c.valid[1] && c.values[0] != 0)
+                out << ", IPC " << static_cast<double>(c.values[1]) / static_cast<double>(c.values[0]);
+            out << '\n';
+        }
+
+        const auto &r = phases[static_cast<int>(perf_phase::render)];
+        if (measured[static_cast<int>(perf_phase::render)] && rays != 0)
+        {
+            out << "  per ray     ";
+            for (int i = 0; i < perf_counter_count; ++i)
+            {
+                if (r.valid[i])
+                    out << (i == 0 ? " " : ", ") << static_cast<double>(r.values[i]) / static_cast<double>(rays) << ' '
+                        << perf_counter_names[i];
+            }
+            out << '\n';
+        }
+        out.flags(flags);
+        out.precision(prec);
+    }
+
+  private:
+    std::atomic<bool> on{false};
+    std::mutex        lock;
+    perf_counts       phases[static_cast<int>(perf_phase::count)];
+    bool              measured[static_cast<int>(perf_phase::count)] = {};
+    std::string       failure;
+};
+
+inline perf_report perf_counters;
+
+// Counts the calling thread from construction to destruction, or to end,
+// towards phase.  Does nothing unless --perf enabled the counters.
+class perf_scope
+{
+  public:
+    explicit perf_scope(perf_phase p) : phase{p}
+    {
+        if (!perf_counters.enabled())
+            return;
+        std::string why;
+        if (group.open(why))
+            counting = true;
+        else
+            perf_counters.fail(why);
+    }
+
+    ~perf_scope() { end(); }
+
+    void end()
+    {
+        if (!counting)
+            return;
+        perf_counters.add(phase, group.read());
+        group.close();
+        counting = false;
+    }
+
+  private:
+    perf_phase phase;
+    perf_group group;
+    bool       counting = false;
+};
+
+#endif
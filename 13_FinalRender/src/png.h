@@ -0,0 +1,547 @@
+#ifndef PNG_H
+#define PNG_H
+
+#include "image_encoder.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A dependency-free PNG writer for 8-bit RGB images.
+//
+// Each band of rows handed to the encoder is cut into pieces that are filtered
+// and deflated on separate threads.  Every piece is an independent deflate
+// fragment that ends on a byte boundary with an empty stored block (a "sync
+// flush"), so the fragments can simply be concatenated into one zlib stream.
+// Their Adler-32 checksums are combined arithmetically rather than recomputed
+// over the whole image.  The deflate side uses LZ77 with hash chains and the
+// fixed Huffman code, which keeps the encoder short and fast.
+
+// CRC-32 as used by PNG chunks.  Chaining calls gives the CRC of the
+// concatenated input, starting from 0.
+inline std::uint32_t crc32_update(std::uint32_t crc, const std::uint8_t *data, std::size_t count)
+{
+    static const auto table = []()
+    {
+        std::array<std::uint32_t, 256> t{};
+        for (std::uint32_t n = 0; n < 256; ++n)
+        {
+            std::uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+
+    crc = ~crc;
+    for (std::size_t i = 0; i < count; ++i)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Adler-32 as used by zlib, starting from 1.
+inline std::uint32_t adler32_update(std::uint32_t adler, const std::uint8_t *data, std::size_t count)
+{
+    const std::uint32_t base = 65521;
+    std::uint32_t       a    = adler & 0xffff;
+    std::uint32_t       b    = adler >> 16;
+
+    while (count > 0)
+    {
+        // 5552 is the largest run that cannot overflow b before the modulo.
+        auto n = std::min<std::size_t>(count, 5552);
+        count -= n;
+        for (; n > 0; --n)
+        {
+            a += *data++;
+            b += a;
+        }
+        a %= base;
+        b %= base;
+    }
+    return (b << 16) | a;
+}
+
+// Adler-32 of A followed by B, given the checksums of each and B's length.
+inline std::uint32_t adler32_combine(std::uint32_t adler_a, std::uint32_t adler_b, std::uint64_t length_b)
+{
+    const std::uint32_t base = 65521;
+    auto                rem  = static_cast<std::uint32_t>(length_b % base);
+    std::uint32_t       sum1 = adler_a & 0xffff;
+    std::uint32_t       sum2 = static_cast<std::uint32_t>((static_cast<std::uint64_t>(rem) * sum1) % base);
+
+    sum1 += (adler_b & 0xffff) + base - 1;
+    sum2 += (adler_a >> 16) + (adler_b >> 16) + base - rem;
+    if (sum1 >= base)
+        sum1 -= base;
+    if (sum1 >= base)
+        sum1 -= base;
+    if (sum2 >= 2 * base)
+        sum2 -= 2 * base;
+    if (sum2 >= base)
+        sum2 -= base;
+    return (sum2 << 16) | sum1;
+}
+
+// Deflate output.  Bits are packed least significant first; Huffman codes are
+// defined most significant bit first and are stored pre-reversed below.  The
+// caller provides a buffer large enough for everything written.
+class deflate_bits
+{
+  public:
+    explicit deflate_bits(std::uint8_t *o) : cursor{o} {}
+
+    void put(std::uint32_t value, int count)
+    {
+        buffer |= static_cast<std::uint64_t>(value) << filled;
+        filled += count;
+        if (filled >= 32)
+        {
+            cursor[0] = static_cast<std::uint8_t>(buffer);
+            cursor[1] = static_cast<std::uint8_t>(buffer >> 8);
+            cursor[2] = static_cast<std::uint8_t>(buffer >> 16);
+            cursor[3] = static_cast<std::uint8_t>(buffer >> 24);
+            cursor += 4;
+            buffer >>= 32;
+            filled -= 32;
+        }
+    }
+
+    // Pad to a byte boundary, flush, and return the end of the output.
+    std::uint8_t *align()
+    {
+        for (; filled > 0; filled -= 8)
+        {
+            *cursor++ = static_cast<std::uint8_t>(buffer);
+            buffer >>= 8;
+        }
+        filled = 0;
+        return cursor;
+    }
+
+  private:
+    std::uint8_t *cursor;
+    std::uint64_t buffer = 0;
+    int           filled = 0;
+};
+
+// The fixed Huffman code of RFC 1951 section 3.2.6 and the length and
+// distance symbol tables of section 3.2.5.
+struct deflate_tables
+{
+    std::array<std::uint16_t, 288> lit_code{};
+    std::array<std::uint8_t, 288>  lit_bits{};
+    std::array<std::uint8_t, 30>   dist_code{};
+    std::array<std::uint8_t, 259>  length_symbol{};
+
+    static constexpr std::array<std::uint16_t, 29> length_base = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                                                  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static constexpr std::array<std::uint8_t, 29>  length_extra = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                                                   3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static constexpr std::array<std::uint16_t, 30> dist_base = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                                                193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+                                                                6145, 8193, 12289, 16385, 24577};
+    static constexpr std::array<std::uint8_t, 30>  dist_extra = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                                                 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+    static std::uint32_t reverse(std::uint32_t code, int bits)
+    {
+        std::uint32_t r = 0;
+        for (int i = 0; i < bits; ++i)
+            r |= ((code >> i) & 1) << (bits - 1 - i);
+        return r;
+    }
+
+    deflate_tables()
+    {
+        for (int s = 0; s < 288; ++s)
+        {
+            std::uint32_t code = 0;
+            int           bits = 0;
+            if (s < 144)
+            {
+                code = 0x30 + s;
+                bits = 8;
+            }
+            else if (s < 256)
+            {
+                code = 0x190 + (s - 144);
+                bits = 9;
+            }
+            else if (s < 280)
+            {
+                code = s - 256;
+                bits = 7;
+            }
+            else
+            {
+                code = 0xc0 + (s - 280);
+                bits = 8;
+            }
+            lit_code[s] = static_cast<std::uint16_t>(reverse(code, bits));
+            lit_bits[s] = static_cast<std::uint8_t>(bits);
+        }
+
+        for (int d = 0; d < 30; ++d)
+            dist_code[d] = static_cast<std::uint8_t>(reverse(d, 5));
+
+        for (int s = 0, len = 3; len <= 258; ++len)
+        {
+            while (s < 28 && len >= length_base[s + 1])
+                ++s;
+            length_symbol[len] = static_cast<std::uint8_t>(s);
+        }
+    }
+
+    static const deflate_tables &get()
+    {
+        static const deflate_tables tables;
+        return tables;
+    }
+};
+
+// Compress data as one fixed-Huffman block followed by a sync flush, leaving
+// the output byte aligned.  The block never refers back before its own start.
+// Positions are kept as int, so size must stay below 2 GiB.
+inline void deflate_block(const std::uint8_t *data, std::size_t size, std::vector<std::uint8_t> &out)
+{
+    const int         hash_bits = 15;
+    const std::size_t window    = 32768;
+    const int         max_chain = 4;
+    const std::size_t nice_len  = 64;
+    const std::size_t max_match = 258;
+    const auto       &tables    = deflate_tables::get();
+    std::vector<int>  head(std::size_t{1} << hash_bits, -1);
+    std::vector<int>  prev(window, -1);
+
+    // Fixed codes never take more than 9 bits per input byte.
+    auto start = out.size();
+    out.resize(start + size + size / 8 + 16);
+    deflate_bits bits(out.data() + start);
+
+    auto hash = [&](std::size_t i)
+    {
+        std::uint32_t v = static_cast<std::uint32_t>(data[i]) << 16 | static_cast<std::uint32_t>(data[i + 1]) << 8 | data[i + 2];
+        return (v * 2654435761u) >> (32 - hash_bits);
+    };
+    auto insert = [&](std::size_t i)
+    {
+        auto h           = hash(i);
+        prev[i % window] = head[h];
+        head[h]          = static_cast<int>(i);
+    };
+    auto literal = [&](int symbol) { bits.put(tables.lit_code[symbol], tables.lit_bits[symbol]); };
+
+    // Block header: not final, fixed Huffman codes.
+    bits.put(0, 1);
+    bits.put(1, 2);
+
+    std::size_t i = 0;
+    while (i < size)
+    {
+        std::size_t best_len  = 0;
+        std::size_t best_dist = 0;
+
+        if (i + 3 <= size)
+        {
+            auto limit = std::min(max_match, size - i);
+            int  cand  = head[hash(i)];
+            insert(i);
+
+            for (int chain = max_chain; cand >= 0 && chain > 0; --chain)
+            {
+                auto c = static_cast<std::size_t>(cand);
+                if (i - c > window)
+                    break;
+                if (data[c + best_len] == data[i + best_len])
+                {
+                    std::size_t len = 0;
+                    while (len < limit && data[c + len] == data[i + len])
+                        ++len;
+                    if (len > best_len)
+                    {
+                        best_len  = len;
+                        best_dist = i - c;
+                        if (len == limit || len >= nice_len)
+                            break;
+                    }
+                }
+                // Chain entries older than the window may have been reused;
+                // a link that does not go backwards is stale.
+                int next = prev[c % window];
+                if (next >= cand)
+                    break;
+                cand = next;
+            }
+        }
+
+        if (best_len < 3)
+        {
+            literal(data[i]);
+            ++i;
+            continue;
+        }
+
+        int ls = tables.length_symbol[best_len];
+        literal(257 + ls);
+        bits.put(static_cast<std::uint32_t>(best_len - deflate_tables::length_base[ls]), deflate_tables::length_extra[ls]);
+
+        int ds = static_cast<int>(std::upper_bound(deflate_tables::dist_base.begin(), deflate_tables::dist_base.end(), best_dist) -
+                                  deflate_tables::dist_base.begin()) -
+                 1;
+        bits.put(tables.dist_code[ds], 5);
+        bits.put(static_cast<std::uint32_t>(best_dist - deflate_tables::dist_base[ds]), deflate_tables::dist_extra[ds]);
+
+        for (std::size_t k = 1; k < best_len && i + k + 3 <= size; ++k)
+            insert(i + k);
+        i += best_len;
+    }
+
+    // End of block, then an empty stored block to reach a byte boundary.
+    literal(256);
+    bits.put(0, 1);
+    bits.put(0, 2);
+    out.resize(static_cast<std::size_t>(bits.align() - out.data()));
+    out.insert(out.end(), {0x00, 0x00, 0xff, 0xff});
+}
+
+// Compress data as blocks of at most 1 GiB, each ending in a sync flush.  The
+// fragment never refers back before its own start, so fragments made
+// independently can be concatenated.
+inline void deflate_fragment(const std::uint8_t *data, std::size_t size, std::vector<std::uint8_t> &out)
+{
+    const std::size_t max_block = std::size_t{1} << 30;
+    std::size_t       offset    = 0;
+    do
+    {
+        auto n = std::min(max_block, size - offset);
+        deflate_block(data + offset, n, out);
+        offset += n;
+    } while (offset < size);
+}
+
+// PNG filters predict each byte from its neighbours: a is the byte one pixel
+// to the left, b the one above and c the one above-left.
+inline std::uint8_t paeth(int a, int b, int c)
+{
+    int p  = a + b - c;
+    int pa = std::abs(p - a);
+    int pb = std::abs(p - b);
+    int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return static_cast<std::uint8_t>(a);
+    return static_cast<std::uint8_t>(pb <= pc ? b : c);
+}
+
+// Filter one row into out (filter byte first), choosing the filter whose
+// output has the smallest sum of absolute signed values, the usual heuristic.
+// Each filter is its own straight loop so the compiler can vectorize the
+// simple ones.
+inline void filter_row(const std::uint8_t *row, const std::uint8_t *above, std::size_t stride, std::uint8_t *out,
+                       std::vector<std::uint8_t> &scratch)
+{
+    const std::size_t bpp = 3;
+    scratch.resize(stride * 5);
+
+    std::uint8_t *none  = scratch.data();
+    std::uint8_t *sub   = none + stride;
+    std::uint8_t *up    = sub + stride;
+    std::uint8_t *avg   = up + stride;
+    std::uint8_t *pae   = avg + stride;
+    std::size_t   first = std::min(bpp, stride);
+
+    std::copy(row, row + stride, none);
+    for (std::size_t x = 0; x < first; ++x)
+    {
+        sub[x] = row[x];
+        up[x]  = static_cast<std::uint8_t>(row[x] - above[x]);
+        avg[x] = static_cast<std::uint8_t>(row[x] - above[x] / 2);
+        pae[x] = static_cast<std::uint8_t>(row[x] - above[x]);
+    }
+    for (std::size_t x = first; x < stride; ++x)
+        sub[x] = static_cast<std::uint8_t>(row[x] - row[x - bpp]);
+    for (std::size_t x = first; x < stride; ++x)
+        up[x] = static_cast<std::uint8_t>(row[x] - above[x]);
+    for (std::size_t x = first; x < stride; ++x)
+        avg[x] = static_cast<std::uint8_t>(row[x] - (row[x - bpp] + above[x]) / 2);
+    for (std::size_t x = first; x < stride; ++x)
+        pae[x] = static_cast<std::uint8_t>(row[x] - paeth(row[x - bpp], above[x], above[x - bpp]));
+
+    int  best      = 0;
+    long best_cost = -1;
+    for (int f = 0; f < 5; ++f)
+    {
+        const std::uint8_t *candidate = scratch.data() + f * stride;
+        long                cost      = 0;
+        for (std::size_t x = 0; x < stride; ++x)
+            cost += candidate[x] < 128 ? candidate[x] : 256 - candidate[x];
+        if (best_cost < 0 || cost < best_cost)
+        {
+            best      = f;
+            best_cost = cost;
+        }
+    }
+
+    out[0] = static_cast<std::uint8_t>(best);
+    std::copy(scratch.data() + best * stride, scratch.data() + (best + 1) * stride, out + 1);
+}
+
+class png_encoder : public image_encoder
+{
+  public:
+    png_encoder(std::ostream &o, int w, int h, int threads, const std::vector<std::string> &comments)
+        : image_encoder(o, w, h), thread_count{std::max(threads, 1)},
+          previous(static_cast<std::size_t>(w) * 3, 0)
+    {
+        static const std::uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        emit(signature, sizeof(signature));
+
+        std::vector<std::uint8_t> ihdr;
+        put_u32(ihdr, static_cast<std::uint32_t>(w));
+        put_u32(ihdr, static_cast<std::uint32_t>(h));
+        ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0}); // 8-bit RGB, deflate, adaptive filters, no interlace
+        write_chunk("IHDR", ihdr);
+
+        for (const auto &c : comments)
+        {
+            std::string text = std::string("Comment") + '\0' + c;
+            write_chunk("tEXt", std::vector<std::uint8_t>(text.begin(), text.end()));
+        }
+    }
+
+  protected:
+    // Pieces are at least this many input bytes; smaller bands (a single row
+    // from --stream, say) are not worth a thread.
+    static constexpr std::size_t min_piece_bytes = 256 * 1024;
+
+    struct piece
+    {
+        std::vector<std::uint8_t> data;
+        std::uint32_t             adler  = 1;
+        std::uint64_t             length = 0;
+    };
+
+    void encode_rows(const std::uint8_t *rgb, int rows) override
+    {
+        if (rows <= 0)
+            return;
+
+        auto stride = static_cast<std::size_t>(width) * 3;
+        auto wanted = static_cast<int>(std::max<std::size_t>(1, rows * stride / min_piece_bytes));
+        int  count  = std::min({thread_count, rows, wanted});
+
+        std::vector<piece> pieces(count);
+        auto               compress = [&](int p)
+        {
+            int first = rows * p / count;
+            int last  = rows * (p + 1) / count;
+
+            std::vector<std::uint8_t> filtered(static_cast<std::size_t>(last - first) * (stride + 1));
+            std::vector<std::uint8_t> scratch;
+            for (int r = first; r < last; ++r)
+            {
+                const std::uint8_t *above = r == 0 ? previous.data() : rgb + (r - 1) * stride;
+                filter_row(rgb + r * stride, above, stride, filtered.data() + (r - first) * (stride + 1), scratch);
+            }
+
+            pieces[p].adler  = adler32_update(1, filtered.data(), filtered.size());
+            pieces[p].length = filtered.size();
+            deflate_fragment(filtered.data(), filtered.size(), pieces[p].data);
+        };
+
+        std::vector<std::thread> workers;
+        for (int p = 1; p < count; ++p)
+            workers.emplace_back(compress, p);
+        compress(0);
+        for (auto &w : workers)
+            w.join();
+
+        std::vector<std::uint8_t> idat;
+        if (!started)
+        {
+            idat.insert(idat.end(), {0x78, 0x01}); // zlib header: deflate, 32K window
+            started = true;
+        }
+        for (const auto &p : pieces)
+        {
+            idat.insert(idat.end(), p.data.begin(), p.data.end());
+            adler = adler32_combine(adler, p.adler, p.length);
+        }
+        write_idat(idat);
+
+        std::copy(rgb + (rows - 1) * stride, rgb + rows * stride, previous.begin());
+    }
+
+    void encode_end() override
+    {
+        std::vector<std::uint8_t> idat;
+        if (!started)
+            idat.insert(idat.end(), {0x78, 0x01});
+
+        // A final, empty fixed-Huffman block closes the deflate stream.
+        std::uint8_t last[2];
+        deflate_bits bits(last);
+        bits.put(1, 1);
+        bits.put(1, 2);
+        bits.put(0, 7);
+        idat.insert(idat.end(), last, bits.align());
+        put_u32(idat, adler);
+        write_idat(idat);
+        write_chunk("IEND", {});
+    }
+
+  private:
+    static void put_u32(std::vector<std::uint8_t> &v, std::uint32_t x)
+    {
+        v.insert(v.end(), {static_cast<std::uint8_t>(x >> 24), static_cast<std::uint8_t>(x >> 16),
+                           static_cast<std::uint8_t>(x >> 8), static_cast<std::uint8_t>(x)});
+    }
+
+    void write_chunk(const char *type, const std::uint8_t *data, std::size_t size)
+    {
+        std::vector<std::uint8_t> head;
+        put_u32(head, static_cast<std::uint32_t>(size));
+        head.insert(head.end(), type, type + 4);
+
+        auto crc = crc32_update(0, head.data() + 4, 4);
+        crc      = crc32_update(crc, data, size);
+
+        std::vector<std::uint8_t> tail;
+        put_u32(tail, crc);
+
+        emit(head.data(), head.size());
+        emit(data, size);
+        emit(tail.data(), tail.size());
+    }
+
+    void write_chunk(const char *type, const std::vector<std::uint8_t> &data)
+    {
+        write_chunk(type, data.data(), data.size());
+    }
+
+    // A chunk may hold at most 2^31 - 1 bytes, so a large band of compressed
+    // data goes out as several IDAT chunks; readers concatenate them.
+    void write_idat(const std::vector<std::uint8_t> &data)
+    {
+        const std::size_t max_chunk = std::size_t{1} << 30;
+        std::size_t       offset    = 0;
+        do
+        {
+            auto n = std::min(max_chunk, data.size() - offset);
+            write_chunk("IDAT", data.data() + offset, n);
+            offset += n;
+        } while (offset < data.size());
+    }
+
+    int                       thread_count;
+    std::vector<std::uint8_t> previous;
+    std::uint32_t             adler   = 1;
+    bool                      started = false;
+};
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef PPM_H
+#define PPM_H
+
+#include "image_encoder.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// A PPM image (text P3 or binary P6) held as 8-bit RGB triples, top scanline
+// first.  Comment lines from the header are kept (without the leading '#')
+// because partial renders use them to say where they belong in the full image.
+
+struct ppm_image
+{
+    bool                     binary = false;
+    int                      width  = 0;
+    int                      height = 0;
+    std::vector<std::string> comments;
+    std::vector<int>         samples;
+
+    int       &at(int x, int y, int c) { return samples[(static_cast<std::size_t>(y) * width + x) * 3 + c]; }
+    const int &at(int x, int y, int c) const { return samples[(static_cast<std::size_t>(y) * width + x) * 3 + c]; }
+};
+
+inline void write_ppm_header(std::ostream &out, const char *magic, int width, int height, const std::vector<std::string> &comments)
+{
+    out << magic << '\n';
+    for (const auto &c : comments)
+        out << "# " << c << '\n';
+    out << width << ' ' << height << "\n255\n";
+}
+
+// Skip whitespace and comments between header fields, collecting the comments.
+inline void skip_ppm_space(std::istream &in, std::vector<std::string> &comments)
+{
+    while (in)
+    {
+        int ch = in.peek();
+        if (ch == '#')
+        {
+            std::string line;
+            std::getline(in, line);
+            auto start = line.find_first_not_of("# ");
+            comments.push_back(start == std::string::npos ? "" : line.substr(start));
+        }
+        else if (std::isspace(ch))
+        {
+            in.get();
+        }
+        else
+        {
+            return;
+        }
+    }
+}
+
+inline bool read_ppm(std::istream &in, ppm_image &image)
+{
+    std::string magic;
+    int         max_value = 0;
+
+    in >> magic;
+    if (magic != "P3" && magic != "P6")
+        return false;
+    image.binary = magic == "P6";
+
+    skip_ppm_space(in, image.comments);
+    in >> image.width;
+    skip_ppm_space(in, image.comments);
+    in >> image.height;
+    skip_ppm_space(in, image.comments);
+    in >> max_value;
+    if (!in || image.width <= 0 || image.height <= 0 || max_value != 255)
+        return false;
+
+    image.samples.resize(static_cast<std::size_t>(image.width) * image.height * 3);
+    if (image.binary)
+    {
+        // Exactly one whitespace byte separates the header from the pixels.
+        in.get();
+        std::vector<unsigned char> bytes(image.samples.size());
+        in.read(reinterpret_cast<char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        std::copy(bytes.begin(), bytes.end(), image.samples.begin());
+    }
+    else
+    {
+        for (auto &s : image.samples)
+            in >> s;
+    }
+    return static_cast<bool>(in);
+}
+
+inline void write_ppm(std::ostream &out, const ppm_image &image)
+{
+    write_ppm_header(out, image.binary ? "P6" : "P3", image.width, image.height, image.comments);
+    if (image.binary)
+    {
+        std::vector<unsigned char> bytes(image.samples.begin(), image.samples.end());
+        out.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        return;
+    }
+
+    for (int y = 0; y < image.height; ++y)
+    {
+        for (int x = 0; x < image.width; ++x)
+            out << image.at(x, y, 0) << ' ' << image.at(x, y, 1) << ' ' << image.at(x, y, 2) << '\n';
+    }
+}
+
+// Streams P3 text or P6 bytes.  Header comments are only used by partial
+// renders, see region_comments().
+class ppm_encoder : public image_encoder
+{
+  public:
+    ppm_encoder(std::ostream &o, int w, int h, bool binary_output, const std::vector<std::string> &comments)
+        : image_encoder(o, w, h), binary{binary_output}
+    {
+        std::ostringstream header;
+        write_ppm_header(header, binary ? "P6" : "P3", w, h, comments);
+        auto text = header.str();
+        emit(text.data(), text.size());
+    }
+
+  protected:
+    void encode_rows(const std::uint8_t *rgb, int rows) override
+    {
+        auto count = static_cast<std::size_t>(width) * rows * 3;
+        if (binary)
+        {
+            emit(rgb, count);
+            return;
+        }
+
+        // Format the band into one buffer rather than going through the
+        // stream's formatting for every integer.
+        std::string text;
+        for (std::size_t k = 0; k < count; k += 3)
+        {
+            text += std::to_string(rgb[k]);
+            text += ' ';
+            text += std::to_string(rgb[k + 1]);
+            text += ' ';
+            text += std::to_string(rgb[k + 2]);
+            text += '\n';
+        }
+        emit(text.data(), text.size());
+    }
+
+  private:
+    bool binary;
+};
+
+#endif
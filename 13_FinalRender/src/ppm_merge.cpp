@@ -0,0 +1,108 @@
+#include "ppm.h"
+#include "region.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// Patch partial renders (made with --crop or --tiles) into a full image.
+// P3 and P6 files may be mixed; the result uses the format of the full image.
+//
+//   ppm_merge full.ppm patch1.ppm [patch2.ppm ...] > merged.ppm
+//
+// Only the pixels inside each patch's "# rect" lines are copied; later
+// patches win where they overlap.
+
+bool load(const char *path, ppm_image &image)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in || !read_ppm(in, image))
+    {
+        std::cerr << "Cannot read PPM image " << path << '\n';
+        return false;
+    }
+    return true;
+}
+
+bool apply_patch(ppm_image &base, const ppm_image &patch, const char *path)
+{
+    int                     full_width  = 0;
+    int                     full_height = 0;
+    int                     offset_x    = -1;
+    int                     offset_y    = -1;
+    std::vector<pixel_rect> rects;
+
+    for (const auto &c : patch.comments)
+    {
+        std::istringstream ss(c);
+        std::string        keyword;
+        ss >> keyword;
+        if (keyword == "region")
+        {
+            ss >> full_width >> full_height >> offset_x >> offset_y;
+        }
+        else if (keyword == "rect")
+        {
+            pixel_rect r;
+            ss >> r.x0 >> r.y0 >> r.x1 >> r.y1;
+            rects.push_back(r);
+        }
+    }
+
+    if (offset_x < 0 || offset_y < 0)
+    {
+        std::cerr << path << " has no region comment; it is not a partial render\n";
+        return false;
+    }
+    if (full_width != base.width || full_height != base.height)
+    {
+        std::cerr << path << " was rendered for a " << full_width << 'x' << full_height
+                  << " image, not " << base.width << 'x' << base.height << '\n';
+        return false;
+    }
+    if (patch.width > base.width - offset_x || patch.height > base.height - offset_y)
+    {
+        std::cerr << path << " is a " << patch.width << 'x' << patch.height << " patch at " << offset_x << ','
+                  << offset_y << ", which does not fit the " << base.width << 'x' << base.height << " image\n";
+        return false;
+    }
+
+    pixel_rect extent{offset_x, offset_y, offset_x + patch.width, offset_y + patch.height};
+    for (const auto &rect : rects)
+    {
+        auto r = intersect(rect, extent);
+        for (int y = r.y0; y < r.y1; ++y)
+        {
+            for (int x = r.x0; x < r.x1; ++x)
+            {
+                for (int c = 0; c < 3; ++c)
+                    base.at(x, y, c) = patch.at(x - offset_x, y - offset_y, c);
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " full.ppm patch.ppm [patch.ppm ...] > merged.ppm\n";
+        return 1;
+    }
+
+    ppm_image base;
+    if (!load(argv[1], base))
+        return 1;
+    base.comments.clear();
+
+    for (int i = 2; i < argc; ++i)
+    {
+        ppm_image patch;
+        if (!load(argv[i], patch) || !apply_patch(base, patch, argv[i]))
+            return 1;
+    }
+
+    write_ppm(std::cout, base);
+    return 0;
+}
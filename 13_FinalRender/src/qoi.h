@@ -0,0 +1,133 @@
+#ifndef QOI_H
+#define QOI_H
+
+#include "image_encoder.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// "Quite OK Image" writer (https://qoiformat.org) for 8-bit RGB.  QOI is a
+// single pass over the pixels with a 64-entry colour cache and small deltas,
+// several times faster than deflate at a modest size cost, which suits
+// previews.  The encoder state carries across bands, so the image may be
+// written in strips or rows.
+
+class qoi_encoder : public image_encoder
+{
+  public:
+    qoi_encoder(std::ostream &o, int w, int h) : image_encoder(o, w, h)
+    {
+        std::vector<std::uint8_t> header = {'q', 'o', 'i', 'f'};
+        put_u32(header, static_cast<std::uint32_t>(w));
+        put_u32(header, static_cast<std::uint32_t>(h));
+        header.push_back(3); // RGB
+        header.push_back(0); // sRGB with linear alpha
+        emit(header.data(), header.size());
+
+        pixels_left = static_cast<std::uint64_t>(w) * h;
+    }
+
+  protected:
+    void encode_rows(const std::uint8_t *rgb, int rows) override
+    {
+        const std::uint8_t op_index = 0x00;
+        const std::uint8_t op_diff  = 0x40;
+        const std::uint8_t op_luma  = 0x80;
+        const std::uint8_t op_run   = 0xc0;
+        const std::uint8_t op_rgb   = 0xfe;
+
+        auto                      count = static_cast<std::size_t>(width) * rows;
+        std::vector<std::uint8_t> bytes;
+        bytes.reserve(count * 4);
+
+        for (std::size_t p = 0; p < count; ++p, --pixels_left)
+        {
+            pixel px{rgb[p * 3], rgb[p * 3 + 1], rgb[p * 3 + 2]};
+
+            if (px == prev)
+            {
+                ++run;
+                if (run == 62 || pixels_left == 1)
+                {
+                    bytes.push_back(static_cast<std::uint8_t>(op_run | (run - 1)));
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run > 0)
+            {
+                bytes.push_back(static_cast<std::uint8_t>(op_run | (run - 1)));
+                run = 0;
+            }
+
+            // Alpha is always 255, so its term of the hash is constant.
+            int slot = (px.r * 3 + px.g * 5 + px.b * 7 + 255 * 11) % 64;
+            if (index_valid[slot] && index[slot] == px)
+            {
+                bytes.push_back(static_cast<std::uint8_t>(op_index | slot));
+            }
+            else
+            {
+                index[slot]       = px;
+                index_valid[slot] = true;
+
+                auto dr    = static_cast<std::int8_t>(px.r - prev.r);
+                auto dg    = static_cast<std::int8_t>(px.g - prev.g);
+                auto db    = static_cast<std::int8_t>(px.b - prev.b);
+                int  dr_dg = dr - dg;
+                int  db_dg = db - dg;
+
+                if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2)
+                {
+                    bytes.push_back(static_cast<std::uint8_t>(op_diff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+                }
+                else if (dr_dg > -9 && dr_dg < 8 && dg > -33 && dg < 32 && db_dg > -9 && db_dg < 8)
+                {
+                    bytes.push_back(static_cast<std::uint8_t>(op_luma | (dg + 32)));
+                    bytes.push_back(static_cast<std::uint8_t>((dr_dg + 8) << 4 | (db_dg + 8)));
+                }
+                else
+                {
+                    bytes.insert(bytes.end(), {op_rgb, px.r, px.g, px.b});
+                }
+            }
+            prev = px;
+        }
+        emit(bytes.data(), bytes.size());
+    }
+
+    void encode_end() override
+    {
+        static const std::uint8_t padding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+        emit(padding, sizeof(padding));
+    }
+
+  private:
+    struct pixel
+    {
+        std::uint8_t r = 0;
+        std::uint8_t g = 0;
+        std::uint8_t b = 0;
+
+        bool operator==(const pixel &o) const { return r == o.r && g == o.g && b == o.b; }
+    };
+
+    static void put_u32(std::vector<std::uint8_t> &v, std::uint32_t x)
+    {
+        v.insert(v.end(), {static_cast<std::uint8_t>(x >> 24), static_cast<std::uint8_t>(x >> 16),
+                           static_cast<std::uint8_t>(x >> 8), static_cast<std::uint8_t>(x)});
+    }
+
+    // The decoder starts from opaque black with an all-zero, transparent
+    // cache.  Our pixels are all opaque, so a cache slot only matches once we
+    // have stored a pixel in it.
+    pixel                 prev;
+    std::array<pixel, 64> index;
+    bool                  index_valid[64] = {};
+    int                   run             = 0;
+    std::uint64_t         pixels_left     = 0;
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef RANDOM_SCENE_H
+#define RANDOM_SCENE_H
+
+#include "flat_scene.h"
+#include "rtweekend.h"
+#include "scene_file.h"
+#include "vec3.h"
+
+#include <cstdint>
+
+// The renderer's built-in scene, the book's final one, held as flat records
+// like a loaded one so it gets a BVH.  It is drawn from the calling thread's
+// random stream: the same scene every run, or another fixed one after
+// seed_random.
+inline scene random_scene()
+{
+    scene world{};
+
+    auto add_material = [&world](material_type type, const color &albedo, double parameter)
+    {
+        material_record m{};
+        m.type      = type;
+        m.albedo[0] = albedo.x();
+        m.albedo[1] = albedo.y();
+        m.albedo[2] = albedo.z();
+        m.parameter = parameter;
+        world.materials.push_back(m);
+        return static_cast<std::uint32_t>(world.materials.size() - 1);
+    };
+    auto add_sphere = [&world](const point3 &center, double radius, std::uint32_t material)
+    {
+        sphere_record s{};
+        s.center[0] = center.x();
+        s.center[1] = center.y();
+        s.center[2] = center.z();
+        s.radius    = radius;
+        s.material  = material;
+        world.spheres.push_back(s);
+    };
+
+    auto ground_material = add_material(material_type::lambertian, color(0.5, 0.5, 0.5), 0);
+    add_sphere(point3(0, -1000, 0), 1000, ground_material);
+
+    for (int a = -11; a < 11; a++)
+    {
+        for (int b = -11; b < 11; b++)
+        {
+            auto   choose_mat = random_double();
+            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9)
+            {
+                if (choose_mat < 0.8)
+                {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    add_sphere(center, 0.2, add_material(material_type::lambertian, albedo, 0));
+                }
+                else if (choose_mat < 0.95)
+                {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz   = random_double(0, 0.5);
+                    add_sphere(center, 0.2, add_material(material_type::metal, albedo, fuzz));
+                }
+                else
+                {
+                    // glass
+                    add_sphere(center, 0.2, add_material(material_type::dielectric, color(), 1.5));
+                }
+            }
+        }
+    }
+
+    auto material1 = add_material(material_type::dielectric, color(), 1.5);
+    add_sphere(point3(0, 1, 0), 1.0, material1);
+
+    auto material2 = add_material(material_type::lambertian, color(0.4, 0.2, 0.1), 0);
+    add_sphere(point3(-4, 1, 0), 1.0, material2);
+
+    auto material3 = add_material(material_type::metal, color(0.7, 0.6, 0.5), 0.0);
+    add_sphere(point3(4, 1, 0), 1.0, material3);
+
+    return world;
+}
+
+#endif
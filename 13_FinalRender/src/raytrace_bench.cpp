@@ -0,0 +1,263 @@
+#include "bench.h"
+#include "bench_history.h"
+#include "bvh.h"
+#include "camera.h"
+#include "color.h"
+#include "flat_scene.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "options.h"
+#include "rtweekend.h"
+#include "sphere.h"
+#include "vec3.h"
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// Microbenchmarks of the renderer's kernels: intersection, sampling, the
+// camera, the materials and pixel output.  Timings go to standard error as a
+// table and to standard output, or --output, as JSON.
+//
+//   raytrace_bench --filter hit --min-time 1 > hits.json
+
+// Inputs are drawn before timing and cycled through, so the kernels are
+// measured without the random number generator and never see the same
+// input twice in a row.
+const std::size_t input_count = 1024;
+
+// Rays from the final scene's camera position towards the sphere field.
+static std::vector<ray> scene_rays()
+{
+    std::vector<ray> rays;
+    camera           cam(point3(13, 2, 3), point3(0, 0, 0), vec3(0, 1, 0), 20, 1.5, 0.0, 10.0);
+    for (std::size_t i = 0; i < input_count; ++i)
+        rays.push_back(cam.get_ray(random_double(), random_double()));
+    return rays;
+}
+
+// count small spheres scattered like the final scene's, with one material.
+static std::vector<sphere_record> small_spheres(std::size_t count)
+{
+    std::vector<sphere_record> spheres(count);
+    double                     side = std::sqrt(static_cast<double>(count));
+    for (auto &s : spheres)
+    {
+        s.center[0] = random_double(-side, side);
+        s.center[1] = 0.2;
+        s.center[2] = random_double(-side, side);
+        s.radius    = 0.2;
+    }
+    return spheres;
+}
+
+// A hit_record as ray_color hands to scatter: a point on a unit sphere hit
+// from outside.
+static std::vector<std::pair<ray, hit_record>> surface_hits()
+{
+    std::vector<std::pair<ray, hit_record>> hits;
+    for (std::size_t i = 0; i < input_count; ++i)
+    {
+        hit_record rec{};
+        vec3       normal = random_unit_vector();
+        rec.p             = normal;
+        rec.t             = 1.0;
+        ray r(normal * 3.0, -normal + 0.3 * random_in_unit_sphere());
+        rec.set_face_normal(r, normal);
+        hits.emplace_back(r, rec);
+    }
+    return hits;
+}
+
+// Discards what is written, so write_color is timed without a device.
+class null_buffer : public std::streambuf
+{
+  protected:
+    int_type overflow(int_type c) override { return c; }
+    std::streamsize xsputn(const char *, std::streamsize n) override { return n; }
+};
+
+static void intersection_benchmarks(bench_runner &bench)
+{
+    auto rays = scene_rays();
+
+    // One sphere the rays hit and one entirely out of their way.
+    sphere           target(point3(0, 1, 0), 1.0, nullptr);
+    sphere           elsewhere(point3(0, -50, 0), 1.0, nullptr);
+    std::vector<ray> towards;
+    for (std::size_t i = 0; i < input_count; ++i)
+        towards.emplace_back(point3(13, 2, 3), point3(0, 1, 0) + 0.5 * random_in_unit_sphere() - point3(13, 2, 3));
+
+    std::size_t i = 0;
+    hit_record  rec{};
+    bench.run("sphere::hit/hit",
+              [&]()
+              {
+                  do_not_optimize(target.hit(towards[i++ % input_count], 0.001, infinity, rec));
+                  do_not_optimize(rec);
+              });
+    bench.run("sphere::hit/miss", [&]() { do_not_optimize(elsewhere.hit(rays[i++ % input_count], 0.001, infinity, rec)); });
+
+    for (std::size_t n : {1, 10, 100, 1000})
+    {
+        hittable_list list;
+        for (const auto &s : small_spheres(n))
+            list.add(std::make_shared<sphere>(point3(s.center[0], s.center[1], s.center[2]), s.radius, nullptr));
+        bench.run("hittable_list::hit/" + std::to_string(n),
+                  [&]() { do_not_optimize(list.hit(rays[i++ % input_count], 0.001, infinity, rec)); }, 1.0, "rays");
+    }
+
+    // The BVH the renderer actually uses, to set the list against.
+    for (std::size_t n : {100, 10000, 1000000})
+    {
+        std::string name = "flat_scene::hit/" + std::to_string(n);
+        if (!bench.selected(name))
+            continue;
+        auto                         spheres = small_spheres(n);
+        auto                         nodes   = build_bvh(spheres);
+        std::vector<material_record> materials(1);
+        flat_scene                   world(spheres, materials, nodes);
+        bench.run(name, [&]() { do_not_optimize(world.hit(rays[i++ % input_count], 0.001, infinity, rec)); }, 1.0, "rays");
+    }
+}
+
+static void sampling_benchmarks(bench_runner &bench)
+{
+    bench.run("random_double", []() { do_not_optimize(random_double()); });
+    bench.run("random_in_unit_sphere", []() { do_not_optimize(random_in_unit_sphere()); });
+    bench.run("random_unit_vector", []() { do_not_optimize(random_unit_vector()); });
+    bench.run("random_in_unit_disk", []() { do_not_optimize(random_in_unit_disk()); });
+
+    camera pinhole(point3(13, 2, 3), point3(0, 0, 0), vec3(0, 1, 0), 20, 1.5, 0.0, 10.0);
+    camera lens(point3(13, 2, 3), point3(0, 0, 0), vec3(0, 1, 0), 20, 1.5, 0.1, 10.0);
+    double s = 0.25;
+    bench.run("camera::get_ray/pinhole", [&]() { do_not_optimize(pinhole.get_ray(s, 0.5)); });
+    bench.run("camera::get_ray/aperture", [&]() { do_not_optimize(lens.get_ray(s, 0.5)); });
+}
+
+static void material_benchmarks(bench_runner &bench)
+{
+    auto        hits = surface_hits();
+    lambertian  diffuse(color(0.5, 0.5, 0.5));
+    metal       shiny(color(0.7, 0.6, 0.5), 0.3);
+    dielectric  glass(1.5);
+    std::size_t i = 0;
+
+    auto scatter = [&](const material &m)
+    {
+        return [&m, &hits, &i]()
+        {
+            const auto &[r, rec] = hits[i++ % input_count];
+            color       attenuation;
+            ray         scattered;
+            do_not_optimize(m.scatter(r, rec, attenuation, scattered));
+            do_not_optimize(scattered);
+        };
+    };
+    bench.run("lambertian::scatter", scatter(diffuse));
+    bench.run("metal::scatter", scatter(shiny));
+    bench.run("dielectric::scatter", scatter(glass));
+}
+
+static void output_benchmarks(bench_runner &bench)
+{
+    null_buffer  discard;
+    std::ostream out(&discard);
+    color        c(0.25, 0.5, 0.75);
+    bench.run("write_color", [&]() { write_color(out, c); });
+    bench.run("write_color/samples", [&]() { write_color(out, c * 100.0, 100); });
+}
+
+static void print_bench_usage(std::ostream &out, const char *program)
+{
+    out << "Usage: " << program << " [options] > results.json\n"
+        << "\n"
+        << "  --filter text        run only benchmarks whose names contain text\n"
+        << "  --min-time s         seconds to spend on each benchmark (default 0.5)\n"
+        << "  --repetitions n      timed repetitions, of which the median is kept\n"
+        << "                       (default 5)\n"
+        << "  --output file        write the JSON to file instead of standard output\n"
+        << "  --history file       also append the results to a benchmark history file\n"
+        << "  --help               show this message\n";
+}
+
+int main(int argc, char **argv)
+{
+    bench_settings settings;
+    std::string    output, history;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            print_bench_usage(std::cout, argv[0]);
+            return 0;
+        }
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << arg << '\n';
+            print_bench_usage(std::cerr, argv[0]);
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--filter")
+        {
+            settings.filter = value;
+        }
+        else if (arg == "--output" || arg == "-o")
+        {
+            output = value;
+        }
+        else if (arg == "--history")
+        {
+            history = value;
+        }
+        else if (arg == "--min-time")
+        {
+            if (!parse_double(value, settings.min_time) || settings.min_time <= 0)
+            {
+                std::cerr << "Bad --min-time value '" << value << "'\n";
+                return 1;
+            }
+        }
+        else if (arg == "--repetitions")
+        {
+            if (!parse_int(value, settings.repetitions) || settings.repetitions <= 0)
+            {
+                std::cerr << "Bad --repetitions value '" << value << "'\n";
+                return 1;
+            }
+        }
+        else
+        {
+            std::cerr << "Unknown option " << arg << '\n';
+            print_bench_usage(std::cerr, argv[0]);
+            return 1;
+        }
+    }
+
+    bench_runner bench(settings);
+    intersection_benchmarks(bench);
+    sampling_benchmarks(bench);
+    material_benchmarks(bench);
+    output_benchmarks(bench);
+
+    if (!history.empty() && !append_history(history, argv[0], bench.all(), std::cerr))
+        return 1;
+    if (output.empty())
+    {
+        bench.write_json(std::cout, argv[0]);
+        return 0;
+    }
+    std::ofstream file(output);
+    bench.write_json(file, argv[0]);
+    if (!file)
+    {
+        std::cerr << "Could not write " << output << '\n';
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,194 @@
+#ifndef REGION_H
+#define REGION_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Pixel coordinates follow the output image: x grows to the right and y grows
+// downwards from the top scanline.  Rectangles are half-open, so x1 and y1 are
+// one past the last pixel.
+
+struct pixel_rect
+{
+    int x0 = 0;
+    int y0 = 0;
+    int x1 = 0;
+    int y1 = 0;
+
+    int  width() const { return x1 - x0; }
+    int  height() const { return y1 - y0; }
+    bool empty() const { return x1 <= x0 || y1 <= y0; }
+
+    bool contains(int x, int y) const
+    {
+        return x >= x0 && x < x1 && y >= y0 && y < y1;
+    }
+};
+
+inline pixel_rect intersect(const pixel_rect &a, const pixel_rect &b)
+{
+    return pixel_rect{std::max(a.x0, b.x0), std::max(a.y0, b.y0), std::min(a.x1, b.x1), std::min(a.y1, b.y1)};
+}
+
+// The set of pixels a run is asked to produce.  A full render is a single
+// rectangle covering the image; --crop and --tiles narrow it down.
+
+class render_region
+{
+  public:
+    render_region() {}
+    render_region(int w, int h) : image_width{w}, image_height{h}
+    {
+        rects.push_back(pixel_rect{0, 0, w, h});
+    }
+
+    // Replace the region with the given rectangles, clipped to the image.
+    void set(const std::vector<pixel_rect> &requested)
+    {
+        rects.clear();
+        for (const auto &r : requested)
+        {
+            auto clipped = intersect(r, pixel_rect{0, 0, image_width, image_height});
+            if (!clipped.empty())
+                rects.push_back(clipped);
+        }
+    }
+
+    // The part of the region inside rect.
+    render_region clipped(const pixel_rect &rect) const
+    {
+        render_region part(image_width, image_height);
+        part.rects.clear();
+        for (const auto &r : rects)
+        {
+            auto c = intersect(r, rect);
+            if (!c.empty())
+                part.rects.push_back(c);
+        }
+        return part;
+    }
+
+    bool full() const
+    {
+        return rects.size() == 1 && rects[0].x0 == 0 && rects[0].y0 == 0 &&
+               rects[0].x1 == image_width && rects[0].y1 == image_height;
+    }
+
+    bool empty() const { return rects.empty(); }
+
+    bool contains(int x, int y) const
+    {
+        for (const auto &r : rects)
+        {
+            if (r.contains(x, y))
+                return true;
+        }
+        return false;
+    }
+
+    // The number of pixels in the region, each counted once however many of
+    // the rectangles cover it.
+    std::uint64_t pixel_count() const
+    {
+        if (rects.size() == 1)
+            return static_cast<std::uint64_t>(rects[0].width()) * static_cast<std::uint64_t>(rects[0].height());
+
+        std::uint64_t                    count = 0;
+        auto                             b     = bounds();
+        std::vector<std::pair<int, int>> spans;
+        for (int y = b.y0; y < b.y1; ++y)
+        {
+            spans.clear();
+            for (const auto &r : rects)
+            {
+                if (y >= r.y0 && y < r.y1)
+                    spans.emplace_back(r.x0, r.x1);
+            }
+            std::sort(spans.begin(), spans.end());
+            int covered = b.x0;
+            for (auto [x0, x1] : spans)
+            {
+                x0 = std::max(x0, covered);
+                if (x1 > x0)
+                {
+                    count += static_cast<std::uint64_t>(x1 - x0);
+                    covered = x1;
+                }
+            }
+        }
+        return count;
+    }
+
+    // Smallest rectangle enclosing every requested pixel; this is the extent
+    // of the image written for a partial render.
+    pixel_rect bounds() const
+    {
+        if (rects.empty())
+            return pixel_rect{};
+
+        pixel_rect b = rects[0];
+        for (const auto &r : rects)
+        {
+            b.x0 = std::min(b.x0, r.x0);
+            b.y0 = std::min(b.y0, r.y0);
+            b.x1 = std::max(b.x1, r.x1);
+            b.y1 = std::max(b.y1, r.y1);
+        }
+        return b;
+    }
+
+    int                     image_width  = 0;
+    int                     image_height = 0;
+    std::vector<pixel_rect> rects;
+};
+
+// Tiles are numbered in row-major order across the full image, starting at 0
+// in the top-left corner.  Edge tiles are clipped to the image.
+
+inline int tiles_across(int image_width, int tile_size)
+{
+    return (image_width + tile_size - 1) / tile_size;
+}
+
+inline int tiles_down(int image_height, int tile_size)
+{
+    return (image_height + tile_size - 1) / tile_size;
+}
+
+inline pixel_rect tile_rect(int tile, int image_width, int image_height, int tile_size)
+{
+    int tx = tile % tiles_across(image_width, tile_size);
+    int ty = tile / tiles_across(image_width, tile_size);
+
+    pixel_rect r{tx * tile_size, ty * tile_size, (tx + 1) * tile_size, (ty + 1) * tile_size};
+    return intersect(r, pixel_rect{0, 0, image_width, image_height});
+}
+
+// Partial renders record where they belong in the full image as PPM comment
+// lines, which any PPM reader skips:
+//
+//   # region <image width> <image height> <offset x> <offset y>
+//   # rect <x0> <y0> <x1> <y1>          (one per rendered rectangle)
+//
+// Pixels of the written image that fall outside every rect are placeholders
+// and are ignored when the patch is merged back.
+
+inline std::vector<std::string> region_comments(const render_region &region)
+{
+    std::vector<std::string> comments;
+    auto                     b = region.bounds();
+
+    comments.push_back("region " + std::to_string(region.image_width) + ' ' + std::to_string(region.image_height) + ' ' +
+                       std::to_string(b.x0) + ' ' + std::to_string(b.y0));
+    for (const auto &r : region.rects)
+    {
+        comments.push_back("rect " + std::to_string(r.x0) + ' ' + std::to_string(r.y0) + ' ' +
+                           std::to_string(r.x1) + ' ' + std::to_string(r.y1));
+    }
+    return comments;
+}
+
+#endif
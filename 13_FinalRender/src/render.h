@@ -0,0 +1,189 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "allocation_tracking.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "heatmap.h"
+#include "hittable.h"
+#include "material.h"
+#include "metrics.h"
+#include "perf_counters.h"
+#include "region.h"
+#include "rtweekend.h"
+#include "trace.h"
+#include "traversal_stats.h"
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// If the cast ray hits the sphere t will be the value used to
+// compute the point of intersection.  Create a new ray from the
+// center of the sphere to this point.  This vector is the
+// surface normal.  The value can range from -1 to 1.  Scale to
+// 0 to 1 to get color gradient to color the sphere.
+// Limit recursion, or ray bouncing, to depth number of recursive calls.
+
+color ray_color(const ray &r, const hittable &world, int depth)
+{
+    hit_record rec;
+
+    // If we've exceeded the ray bound limit, no more light is gathered.
+    if (depth <= 0)
+    {
+        count_path_end(path_end::depth_limit);
+        return color(0, 0, 0);
+    }
+
+    // The 0.001 threshold eliminates shadow acne when bounces occur at t not exactly 0.
+    // This imprecision comes from floating point limitations.  Applying a tolerance fixes
+    // the issue.
+    bool hit = world.hit(r, 0.001, infinity, rec);
+    count_ray(hit);
+    if (hit)
+    {
+        ray   scattered{{0, 0, 0}, {1, 0, 0}};
+        color attenuation{0, 0, 0};
+        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+        {
+            metrics_add(this_thread_metrics->secondary_rays, 1);
+            return attenuation * ray_color(scattered, world, depth - 1);
+        }
+        count_path_end(path_end::absorbed);
+        return color{0, 0, 0};
+
+        // Scattering is determined by material and no longer global here.
+    }
+    count_path_end(path_end::escaped);
+    vec3 unit_direction = unit_vector(r.direction());
+    auto t              = 0.5 * (unit_direction.y() + 1.0);
+    return (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
+}
+
+struct render_settings
+{
+    int       image_width       = 1200;
+    int       image_height      = 800;
+    int       samples_per_pixel = 500;
+    int       max_depth         = 50;
+    int       frame             = 0;
+    cost_map *costs             = nullptr; // per-pixel costs, for --heatmap
+};
+
+// Average of all samples for the pixel at (x, y), y counting down from the top
+// scanline.  The camera's v coordinate counts up from the bottom, hence j.
+// Nothing in here may allocate; builds that track allocations check that.
+inline color render_pixel(const camera &cam, const hittable &world, const render_settings &settings, int x, int y)
+{
+    [[maybe_unused]] hot_path_guard guard;
+    cost_probe     probe(settings.costs, x, y, settings.samples_per_pixel);
+    pixel_stream   stream(x, y, settings.image_width, settings.image_height, settings.frame);
+    metrics_add(this_thread_metrics->primary_rays, static_cast<std::uint64_t>(settings.samples_per_pixel));
+    metrics_add(this_thread_metrics->samples, static_cast<std::uint64_t>(settings.samples_per_pixel));
+
+    int   j = settings.image_height - 1 - y;
+    color pixel_color(0, 0, 0);
+    for (int s = 0; s < settings.samples_per_pixel; ++s)
+    {
+        auto u = (x + random_double()) / (settings.image_width - 1);
+        auto v = (j + random_double()) / (settings.image_height - 1);
+        ray  r = cam.get_ray(u, v);
+        pixel_color += ray_color(r, world, settings.max_depth);
+    }
+    return pixel_color / settings.samples_per_pixel;
+}
+
+// The tiles of the full-image grid that overlap the region, clipped to its
+// bounding box.  Using the same grid as --tiles keeps tile numbers meaningful.
+// Only the grid cells under the bounding box are visited, so a thin strip of
+// a huge image costs no more than the strip itself.
+inline std::vector<pixel_rect> region_tiles(const render_region &region, int tile_size)
+{
+    std::vector<pixel_rect> tiles;
+    if (region.empty())
+        return tiles;
+
+    auto bounds = region.bounds();
+    int  across = tiles_across(region.image_width, tile_size);
+
+    for (int ty = bounds.y0 / tile_size; ty <= (bounds.y1 - 1) / tile_size; ++ty)
+    {
+        for (int tx = bounds.x0 / tile_size; tx <= (bounds.x1 - 1) / tile_size; ++tx)
+        {
+            auto tile = intersect(tile_rect(ty * across + tx, region.image_width, region.image_height, tile_size), bounds);
+            for (const auto &r : region.rects)
+            {
+                if (!intersect(tile, r).empty())
+                {
+                    tiles.push_back(tile);
+                    break;
+                }
+            }
+        }
+    }
+    return tiles;
+}
+
+// Called by a worker thread with each finished tile; pixels holds the tile
+// alone, so its (0, 0) is (tile.x0, tile.y0) in the full image.  Tiles never
+// overlap, so sinks may write their pixels without locking.
+using tile_sink = std::function<void(const pixel_rect &tile, const framebuffer &pixels)>;
+
+// Render every pixel of the region on the given number of threads.  Workers
+// pull tiles from a shared counter until none are left.  Pixels of a tile that
+// lie outside the region are left black.  Progress shows in the metrics.
+inline void render_tiles(const camera &cam, const hittable &world, const render_settings &settings,
+                         const render_region &region, int tile_size, int thread_count, const tile_sink &sink)
+{
+    auto                     tiles = region_tiles(region, tile_size);
+    std::atomic<std::size_t> next_tile{0};
+
+    auto worker = [&](int index)
+    {
+        metrics_worker counted(index);
+        trace_track    track("worker", index);
+        perf_scope     counters(perf_phase::render);
+        for (auto t = next_tile++; t < tiles.size(); t = next_tile++)
+        {
+            metrics_busy busy;
+            const auto  &tile = tiles[t];
+            trace_span   span("tile", "render", {{"x", tile.x0}, {"y", tile.y0}, {"width", tile.width()}, {"height", tile.height()}});
+            framebuffer pixels(tile.width(), tile.height());
+
+            for (int y = tile.y0; y < tile.y1; ++y)
+            {
+                for (int x = tile.x0; x < tile.x1; ++x)
+                {
+                    if (region.contains(x, y))
+                        pixels.set(x - tile.x0, y - tile.y0, render_pixel(cam, world, settings, x, y));
+                }
+            }
+            sink(tile, pixels);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < thread_count; ++i)
+        workers.emplace_back(worker, i);
+    worker(0);
+    for (auto &w : workers)
+        w.join();
+}
+
+// Copy a finished tile into a framebuffer covering the region's bounding box.
+inline tile_sink framebuffer_sink(framebuffer &image, const pixel_rect &bounds)
+{
+    return [&image, bounds](const pixel_rect &tile, const framebuffer &pixels)
+    {
+        for (int y = 0; y < pixels.height(); ++y)
+        {
+            const float *src = pixels.row(y);
+            float       *dst = image.row(tile.y0 - bounds.y0 + y) + (tile.x0 - bounds.x0) * 3;
+            std::copy(src, src + pixels.width() * 3, dst);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef ROW_STREAM_H
+#define ROW_STREAM_H
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "metrics.h"
+#include "perf_counters.h"
+#include "ppm.h"
+#include "region.h"
+#include "render.h"
+#include "trace.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reorder buffer between render workers and a single in-order writer.
+//
+// Rows are claimed in increasing order but may finish in any order.  The
+// buffer holds a window of rows: row r lives in slot r % window and a worker
+// may only start it once every row before r - window has been written.  That
+// caps memory at window rows regardless of image height, and because the
+// oldest unfinished row is always inside the window the workers and writer
+// can never deadlock.
+
+class row_reorder_buffer
+{
+  public:
+    row_reorder_buffer(int row_width, int window_rows)
+        : width{row_width}, window{window_rows},
+          slots(static_cast<std::size_t>(window_rows) * row_width * 3, 0.0f),
+          ready(window_rows, -1)
+    {
+    }
+
+    // Worker side: wait until row may be rendered and return its storage.
+    float *acquire(int row)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        slot_free.wait(lock, [&]() { return row < written + window; });
+        return slot(row);
+    }
+
+    // Worker side: the row's pixels are complete.
+    void commit(int row)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready[row % window] = row;
+        }
+        row_ready.notify_all();
+    }
+
+    // Writer side: wait for row to be committed and return its pixels.
+    const float *wait(int row)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        row_ready.wait(lock, [&]() { return ready[row % window] == row; });
+        return slot(row);
+    }
+
+    // Writer side: the row has been written and its slot may be reused.
+    void release(int row)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            written = row + 1;
+        }
+        slot_free.notify_all();
+    }
+
+  private:
+    float *slot(int row) { return slots.data() + static_cast<std::size_t>(row % window) * width * 3; }
+
+    int                     width;
+    int                     window;
+    std::vector<float>      slots;
+    std::vector<int>        ready;
+    int                     written = 0;
+    std::mutex              mutex;
+    std::condition_variable slot_free;
+    std::condition_variable row_ready;
+};
+
+// Render the region's bounding box row by row on worker threads while a
+// writer thread encodes finished rows to out in scanline order, flushing each
+// one, so a consumer reading the stream sees the image top to bottom as it
+// is produced.  PFM cannot be streamed because it stores its rows bottom
+// first.
+inline void render_rows_ordered(const camera &cam, const hittable &world, const render_settings &settings,
+                                const render_region &region, int thread_count, int window_rows,
+                                std::ostream &out, image_format format, const std::vector<std::string> &comments,
+                                const tonemap &tone)
+{
+    auto               bounds = region.bounds();
+    int                width  = bounds.width();
+    int                height = bounds.height();
+    row_reorder_buffer rows(width, window_rows);
+    std::atomic<int>   next_row{0};
+
+    auto encoder = make_encoder(out, format, width, height, comments, 1);
+    out.flush();
+
+    std::thread writer(
+        [&]()
+        {
+            trace_track               track("row writer");
+            perf_scope                counters(perf_phase::output);
+            std::vector<std::uint8_t> bytes(static_cast<std::size_t>(width) * 3);
+            for (int r = 0; r < height; ++r)
+            {
+                const float *pixels = rows.wait(r);
+                trace_span   span("encode row", "output", {{"row", r}});
+                tone.apply(pixels, bytes.data(), bytes.size());
+                rows.release(r);
+                encoder->write_rows(bytes.data(), 1);
+                out.flush();
+            }
+            trace_span span("finish encoding", "output");
+            encoder->finish();
+        });
+
+    auto worker = [&](int index)
+    {
+        metrics_worker counted(index);
+        trace_track    track("worker", index);
+        perf_scope     counters(perf_phase::render);
+        for (int r = next_row++; r < height; r = next_row++)
+        {
+            float       *pixels = rows.acquire(r);
+            metrics_busy busy;
+            int          y      = bounds.y0 + r;
+            trace_span   span("row", "render", {{"y", y}});
+            for (int x = bounds.x0; x < bounds.x1; ++x)
+            {
+                color c = region.contains(x, y) ? render_pixel(cam, world, settings, x, y) : color(0, 0, 0);
+
+                float *p = pixels + static_cast<std::size_t>(x - bounds.x0) * 3;
+                p[0]     = static_cast<float>(c.x());
+                p[1]     = static_cast<float>(c.y());
+                p[2]     = static_cast<float>(c.z());
+            }
+            rows.commit(r);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < thread_count; ++i)
+        workers.emplace_back(worker, i);
+    worker(0);
+    for (auto &w : workers)
+        w.join();
+    writer.join();
+    render_status.close(std::cerr);
+    encoder->report(std::cerr, format);
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define RTWEEKEND_H
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <limits>
 #include <memory>
@@ -19,13 +20,71 @@ inline double degrees_to_radians(double degrees)
     return degrees * pi / 180.0;
 }
 
+// Every thread owns its generator so render workers never share state.
+inline std::mt19937 &random_generator()
+{
+    static thread_local std::mt19937 generator;
+    return generator;
+}
+
+// The next value of a splitmix64 sequence: a 64-bit counter stepped by the
+// golden ratio and run through a mixing function.  Any state is a valid start.
+inline std::uint64_t splitmix64(std::uint64_t &state)
+{
+    std::uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z               = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z               = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// The state of the stream the calling thread's pixel draws from, if any.
+inline thread_local std::uint64_t *this_thread_pixel_stream = nullptr;
+
 inline double random_double()
 {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937                           generator;
-    return distribution(generator);
+    if (auto *state = this_thread_pixel_stream)
+        return static_cast<double>(splitmix64(*state) >> 11) * 0x1.0p-53;
+    static thread_local std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    return distribution(random_generator());
 }
 
+// Reseed the calling thread's generator from a 64-bit key.  The key is run
+// through splitmix64 first so neighbouring keys still give unrelated streams.
+inline void seed_random(std::uint64_t key)
+{
+    auto z = splitmix64(key);
+    random_generator().seed(static_cast<std::uint32_t>(z ^ (z >> 32)));
+}
+
+// Each pixel draws its samples from its own stream, keyed by its position in
+// the full image.  A pixel therefore renders identically whether the whole
+// frame, a crop or a handful of tiles is being rendered.  Frames of an
+// animation get streams of their own so the noise does not stay fixed on
+// screen; frame 0 is a still.
+//
+// While a pixel_stream exists random_double draws from it rather than from
+// the thread's generator.  It is splitmix64 started at the pixel's 64-bit
+// index across all frames, so starting one costs nothing and no two pixels
+// of any frame start from the same state.
+class pixel_stream
+{
+  public:
+    pixel_stream(int x, int y, int image_width, int image_height, int frame = 0) : outer{this_thread_pixel_stream}
+    {
+        auto pixels              = static_cast<std::uint64_t>(image_width) * static_cast<std::uint64_t>(image_height);
+        auto row                 = static_cast<std::uint64_t>(y) * static_cast<std::uint64_t>(image_width);
+        state                    = static_cast<std::uint64_t>(frame) * pixels + row + static_cast<std::uint64_t>(x);
+        this_thread_pixel_stream = &state;
+    }
+    pixel_stream(const pixel_stream &)            = delete;
+    pixel_stream &operator=(const pixel_stream &) = delete;
+    ~pixel_stream() { this_thread_pixel_stream = outer; }
+
+  private:
+    std::uint64_t  state = 0;
+    std::uint64_t *outer;
+};
+
 inline double random_double(double min, double max)
 {
     // Returns a random real in [min,max).
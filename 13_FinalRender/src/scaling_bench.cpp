@@ -0,0 +1,250 @@
+#include "bench.h"
+#include "bench_history.h"
+#include "bench_scenes.h"
+#include "binary_scene.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "metrics.h"
+#include "options.h"
+#include "region.h"
+#include "render.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// End-to-end thread scaling: fixed scenes rendered at each thread count,
+// image size and sample count, to catch scalability regressions in the tile
+// scheduler, the random number streams or any state the workers share.
+//
+// Strong scaling renders the same image at every thread count; its
+// efficiency is the speedup over one thread divided by the threads.  Weak
+// scaling gives every thread the same work, the samples per pixel growing
+// with the thread count; its efficiency is the one-thread time over the
+// time taken.  Both are 1 when the render scales perfectly.  Each run also
+// reports samples and rays per second and the resident memory.
+//
+//   scaling_bench --threads 1,2,4,8 --sizes 320x213 --samples 16 > scaling.json
+
+// 1, 2, 4 and so on up to and including n.
+static std::vector<int> default_thread_counts(int n)
+{
+    std::vector<int> counts;
+    for (int t = 1; t < n; t *= 2)
+        counts.push_back(t);
+    counts.push_back(n);
+    return counts;
+}
+
+struct render_timing
+{
+    double              seconds = 0;
+    std::uint64_t       rays    = 0;
+    std::vector<double> times   = {}; // nanoseconds of every repetition
+};
+
+// Median of repetitions renders of the whole image.
+static render_timing time_render(const workload &w, int width, int height, int samples, int max_depth, int threads,
+                                 int repetitions)
+{
+    const auto     &view = w.scene->description.camera;
+    camera          cam(view.lookfrom, view.lookat, view.vup, view.vfov, static_cast<double>(width) / height, view.aperture,
+                        view.focus_dist);
+    render_settings settings{width, height, samples, max_depth};
+    render_region   region(width, height);
+    framebuffer     image(width, height);
+
+    std::vector<render_timing> runs;
+    for (int r = 0; r < repetitions; ++r)
+    {
+        auto before = read_metrics(threads).rays();
+        auto start  = std::chrono::steady_clock::now();
+        render_tiles(cam, w.scene->world, settings, region, 32, threads, framebuffer_sink(image, region.bounds()));
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        runs.push_back({seconds, read_metrics(threads).rays() - before});
+    }
+    std::sort(runs.begin(), runs.end(), [](const auto &a, const auto &b) { return a.seconds < b.seconds; });
+    auto median = runs[runs.size() / 2];
+    for (const auto &run : runs)
+        median.times.push_back(run.seconds * 1.0e9);
+    return median;
+}
+
+static void print_scaling_usage(std::ostream &out, const char *program)
+{
+    out << "Usage: " << program << " [options] > scaling.json\n"
+        << "\n"
+        << "  --scenes list        scenes to render: random (the built-in scene),\n"
+        << "                       random:seed, generated:n (default\n"
+        << "                       random,random:1,generated:1000000)\n"
+        << "  --threads list       thread counts (default 1, 2, 4 ... up to all cores)\n"
+        << "  --sizes list         image sizes as WxH (default 160x107,320x213)\n"
+        << "  --samples list       samples per pixel of the one-thread runs (default 4,16)\n"
+        << "  --max-depth n        ray bounce limit (default 50)\n"
+        << "  --repetitions n      renders per point, of which the median is kept\n"
+        << "                       (default 3)\n"
+        << "  --output file        write the JSON to file instead of standard output\n"
+        << "  --history file       also append the results to a benchmark history file\n"
+        << "  --help               show this message\n";
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> scene_specs = {"random", "random:1", "generated:1000000"};
+    std::vector<int>         threads     = default_thread_counts(static_cast<int>(std::max(1u, std::thread::hardware_concurrency())));
+    std::vector<std::string> sizes       = {"160x107", "320x213"};
+    std::vector<int>         samples     = {4, 16};
+    int                      max_depth   = 50;
+    int                      repetitions = 3;
+    std::string              output, history;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            print_scaling_usage(std::cout, argv[0]);
+            return 0;
+        }
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << arg << '\n';
+            print_scaling_usage(std::cerr, argv[0]);
+            return 1;
+        }
+        std::string value = argv[++i];
+        bool        good  = true;
+        if (arg == "--scenes")
+            scene_specs = split_list(value);
+        else if (arg == "--threads")
+            good = parse_int_list(value, threads);
+        else if (arg == "--sizes")
+            sizes = split_list(value);
+        else if (arg == "--samples")
+            good = parse_int_list(value, samples);
+        else if (arg == "--max-depth")
+            good = parse_int(value, max_depth) && max_depth > 0;
+        else if (arg == "--repetitions")
+            good = parse_int(value, repetitions) && repetitions > 0;
+        else if (arg == "--output" || arg == "-o")
+            output = value;
+        else if (arg == "--history")
+            history = value;
+        else
+        {
+            std::cerr << "Unknown option " << arg << '\n';
+            print_scaling_usage(std::cerr, argv[0]);
+            return 1;
+        }
+        if (!good)
+        {
+            std::cerr << "Bad " << arg << " value '" << value << "'\n";
+            return 1;
+        }
+    }
+    for (const auto &size : sizes)
+    {
+        int width = 0, height = 0;
+        if (!parse_size_pair(size, width, height))
+        {
+            std::cerr << "Bad --sizes entry '" << size << "', expected WxH\n";
+            return 1;
+        }
+    }
+    std::sort(threads.begin(), threads.end());
+    threads.erase(std::unique(threads.begin(), threads.end()), threads.end());
+
+    bench_settings settings;
+    settings.repetitions = repetitions;
+    bench_runner results(settings);
+
+    std::cerr << std::left << std::setw(22) << "scene" << std::setw(10) << "size" << std::right << std::setw(6) << "spp"
+              << std::setw(6) << "mode" << std::setw(8) << "threads" << std::setw(10) << "seconds" << std::setw(12)
+              << "Msamples/s" << std::setw(10) << "Mrays/s" << std::setw(8) << "speedup" << std::setw(6) << "eff"
+              << std::setw(9) << "RSS MB" << '\n';
+
+    for (const auto &spec : scene_specs)
+    {
+        workload w;
+        if (!make_workload(spec, w, std::cerr))
+            return 1;
+
+        for (const auto &size : sizes)
+        {
+            int width = 0, height = 0;
+            parse_size_pair(size, width, height);
+            for (int spp : samples)
+            {
+                for (const char *mode : {"strong", "weak"})
+                {
+                    bool   weak  = mode[0] == 'w';
+                    int    first = threads.front();
+                    double base  = 0;
+                    for (int t : threads)
+                    {
+                        int  run_spp = weak ? spp * t : spp;
+                        auto timing  = time_render(w, width, height, run_spp, max_depth, t, repetitions);
+                        if (t == first)
+                            base = timing.seconds;
+
+                        // Throughput over one thread's, taking the smallest
+                        // count to scale perfectly when it is not 1.
+                        double speedup    = (weak ? t : first) * base / timing.seconds;
+                        double efficiency = speedup / t;
+                        double samples_s  = static_cast<double>(width) * height * run_spp / timing.seconds;
+                        double rays_s     = static_cast<double>(timing.rays) / timing.seconds;
+                        double rss_mb     = static_cast<double>(resident_bytes()) / 1.0e6;
+                        double peak_mb    = static_cast<double>(peak_resident_bytes()) / 1.0e6;
+
+                        std::cerr << std::left << std::setw(22) << spec << std::setw(10) << size << std::right
+                                  << std::setw(6) << run_spp << std::setw(6) << mode << std::setw(8) << t << std::fixed
+                                  << std::setprecision(3) << std::setw(10) << timing.seconds << std::setprecision(2)
+                                  << std::setw(12) << samples_s / 1.0e6 << std::setw(10) << rays_s / 1.0e6
+                                  << std::setw(8) << speedup << std::setw(6) << efficiency << std::setprecision(1)
+                                  << std::setw(9) << rss_mb << '\n';
+                        std::cerr.unsetf(std::ios::floatfield);
+
+                        bench_result r;
+                        r.name       = "scaling/" + spec + "/" + size + "/spp:" + std::to_string(spp) + "/" + mode +
+                                 "/threads:" + std::to_string(t);
+                        r.iterations = 1;
+                        r.ns_per_op  = timing.seconds * 1.0e9;
+                        r.min_ns     = timing.times.front();
+                        r.max_ns     = timing.times.back();
+                        r.times      = timing.times;
+                        r.counters   = {{"threads", t},
+                                        {"samples_per_pixel", run_spp},
+                                        {"samples_per_second", samples_s},
+                                        {"rays_per_second", rays_s},
+                                        {"speedup", speedup},
+                                        {"efficiency", efficiency},
+                                        {"resident_mb", rss_mb},
+                                        {"peak_resident_mb", peak_mb}};
+                        results.add(r);
+                    }
+                }
+            }
+        }
+    }
+
+    if (!history.empty() && !append_history(history, argv[0], results.all(), std::cerr))
+        return 1;
+    if (output.empty())
+    {
+        results.write_json(std::cout, argv[0]);
+        return 0;
+    }
+    std::ofstream file(output);
+    results.write_json(file, argv[0]);
+    if (!file)
+    {
+        std::cerr << "Could not write " << output << '\n';
+        return 1;
+    }
+    return 0;
+}
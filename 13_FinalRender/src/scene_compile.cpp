@@ -0,0 +1,37 @@
+#include "binary_scene.h"
+#include "bvh.h"
+#include "scene_file.h"
+
+#include <chrono>
+#include <iostream>
+
+// Compile a text scene into a binary scene file with its BVH prebuilt, so
+// large scenes load by mapping the file instead of parsing and building.
+//
+//   scene_compile spheres.scene spheres.rtscene
+//   raytrace --scene spheres.rtscene > image.ppm
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " input.scene output.rtscene\n";
+        return 1;
+    }
+
+    auto  start   = std::chrono::steady_clock::now();
+    auto  elapsed = [&]() { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+    scene s;
+    if (!read_text_scene(argv[1], s, std::cerr))
+        return 1;
+    std::cerr << "Read " << s.spheres.size() << " spheres and " << s.materials.size() << " materials in "
+              << elapsed() * 1000.0 << " ms.\n";
+
+    start      = std::chrono::steady_clock::now();
+    auto nodes = build_bvh(s.spheres);
+    std::cerr << "Built " << nodes.size() << " BVH nodes in " << elapsed() * 1000.0 << " ms.\n";
+
+    if (!write_binary_scene(argv[2], s, nodes, std::cerr))
+        return 1;
+    return 0;
+}
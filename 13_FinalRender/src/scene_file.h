@@ -0,0 +1,425 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "flat_scene.h"
+#include "vec3.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Text scene descriptions, so scenes can change without a rebuild.
+//
+// One statement per line; '#' starts a comment and blank lines are ignored:
+//
+//   camera   lookfrom 13 2 3  lookat 0 0 0  vup 0 1 0  vfov 20  aperture 0.1  focus_dist 10
+//   render   width 1200  height 800  samples 500  max_depth 50
+//   material ground lambertian 0.5 0.5 0.5
+//   material mirror metal 0.7 0.6 0.5 0.0
+//   material glass  dielectric 1.5
+//   sphere   0 -1000 0  1000  ground
+//   sphere   4 1 0  1.0  metal 0.7 0.6 0.5 0.0
+//
+// camera and render take name/value pairs in any order and may leave any of
+// them out.  A sphere names a material defined earlier, or gives one inline
+// the way a material statement does, which suits generated scenes where most
+// spheres have a material of their own.
+//
+// Scenes with millions of spheres are expected, so the file is read in one
+// go and scanned in place: tokens are views into the buffer and numbers are
+// converted by hand, with no streams, locales or copies.  Spheres and
+// materials go straight into the flat record arrays of flat_scene.h; a
+// material defined by name is stored once and shared by index.
+//
+// The arrays are reserved up front from the number of lines, which bounds
+// the number of statements, so they are allocated once instead of regrown
+// and copied while millions of spheres are added.  Only the pages the
+// records reach are ever touched.  Material names live in an arena owned by
+// the parser and are dropped with it in one go.
+
+struct scene_camera
+{
+    point3 lookfrom   = {13, 2, 3};
+    point3 lookat     = {0, 0, 0};
+    vec3   vup        = {0, 1, 0};
+    double vfov       = 20;
+    double aperture   = 0.1;
+    double focus_dist = 10;
+};
+
+// Render settings are 0 where the scene leaves them to the command line or
+// the program's defaults.
+struct scene
+{
+    scene_camera                 camera;
+    int                          image_width       = 0;
+    int                          image_height      = 0;
+    int                          samples_per_pixel = 0;
+    int                          max_depth         = 0;
+    std::vector<sphere_record>   spheres;
+    std::vector<material_record> materials;
+};
+
+class scene_parser
+{
+  public:
+    scene_parser(std::string_view text, const std::string &file_name, std::ostream &error_stream)
+        : begin{text.data()}, pos{text.data()}, end{text.data() + text.size()}, name{file_name}, err{error_stream},
+          names{&arena}
+    {
+    }
+
+    // Returns false, after reporting the line at fault on err, if the text is
+    // malformed.
+    bool parse(scene &s)
+    {
+        auto lines = static_cast<std::size_t>(std::count(begin, end, '\n')) + 1;
+        s.spheres.reserve(s.spheres.size() + lines);
+        s.materials.reserve(s.materials.size() + lines);
+
+        while (skip_to_statement())
+        {
+            auto keyword = word();
+            bool ok      = false;
+            if (keyword == "sphere")
+                ok = parse_sphere(s);
+            else if (keyword == "material")
+                ok = parse_material_statement(s);
+            else if (keyword == "camera")
+                ok = parse_camera(s.camera);
+            else if (keyword == "render")
+                ok = parse_render(s);
+            else
+                return fail("unknown statement '" + std::string(keyword) + "'");
+
+            if (!ok)
+                return false;
+            if (!line_end())
+                return fail("unexpected '" + std::string(word()) + "'");
+        }
+        return true;
+    }
+
+  private:
+    // Heterogeneous lookup, so a name in the buffer finds its material
+    // without being copied into a std::string first.
+    struct name_hash
+    {
+        using is_transparent = void;
+        std::size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+    };
+    using material_names = std::pmr::unordered_map<std::pmr::string, std::uint32_t, name_hash, std::equal_to<>>;
+
+    static bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    void skip_blanks()
+    {
+        while (pos < end && is_blank(*pos))
+            ++pos;
+        if (pos < end && *pos == '#')
+        {
+            while (pos < end && *pos != '\n')
+                ++pos;
+        }
+    }
+
+    // Skip blank lines and comments.  Returns false at the end of the text.
+    bool skip_to_statement()
+    {
+        for (;;)
+        {
+            skip_blanks();
+            if (pos == end)
+                return false;
+            if (*pos != '\n')
+                return true;
+            ++pos;
+        }
+    }
+
+    // True, having moved past it, if only a comment is left on the line.
+    bool line_end()
+    {
+        skip_blanks();
+        if (pos == end)
+            return true;
+        if (*pos != '\n')
+            return false;
+        ++pos;
+        return true;
+    }
+
+    std::string_view word()
+    {
+        skip_blanks();
+        auto start = pos;
+        while (pos < end && !is_blank(*pos) && *pos != '\n' && *pos != '#')
+            ++pos;
+        return {start, static_cast<std::size_t>(pos - start)};
+    }
+
+    bool at_token_end(const char *p) const { return p == end || is_blank(*p) || *p == '\n' || *p == '#'; }
+
+    // Scene files are mostly short decimals such as -12.375 or 0.2, so those
+    // are converted here directly: with at most 15 significant digits the
+    // digits form an integer a double holds exactly, and one division by an
+    // exact power of ten is correctly rounded, giving the same result as
+    // from_chars.  Exponents and longer numbers are left to from_chars.
+    bool number(double &value)
+    {
+        static const double powers_of_ten[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+                                               1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+
+        skip_blanks();
+        // from_chars does not accept the leading '+' people sometimes write.
+        if (pos < end && *pos == '+')
+            ++pos;
+
+        auto          p        = pos;
+        bool          negative = p < end && *p == '-';
+        std::uint64_t digits   = 0;
+        int           count    = 0;
+        int           fraction = 0;
+        p += negative;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p, ++count)
+            digits = digits * 10 + static_cast<std::uint64_t>(*p - '0');
+        if (p < end && *p == '.')
+        {
+            for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++count, ++fraction)
+                digits = digits * 10 + static_cast<std::uint64_t>(*p - '0');
+        }
+        if (count > 0 && count <= 15 && at_token_end(p))
+        {
+            value = static_cast<double>(digits) / powers_of_ten[fraction];
+            value = negative ? -value : value;
+            pos   = p;
+            return true;
+        }
+
+        auto [next, ec] = std::from_chars(pos, end, value);
+        if (ec != std::errc() || !at_token_end(next))
+            return false;
+        pos = next;
+        return true;
+    }
+
+    bool number(int &value)
+    {
+        skip_blanks();
+        auto [next, ec] = std::from_chars(pos, end, value);
+        if (ec != std::errc() || !at_token_end(next))
+            return false;
+        pos = next;
+        return true;
+    }
+
+    bool numbers(double *values, int count)
+    {
+        for (int k = 0; k < count; ++k)
+        {
+            if (!number(values[k]))
+                return false;
+        }
+        return true;
+    }
+
+    bool vector(vec3 &v)
+    {
+        double x = 0;
+        double y = 0;
+        double z = 0;
+        if (!number(x) || !number(y) || !number(z))
+            return false;
+        v = vec3(x, y, z);
+        return true;
+    }
+
+    // A material description, a type and its parameters, appended to the
+    // scene's materials.
+    bool parse_material(scene &s)
+    {
+        auto            type = word();
+        material_record m{};
+        if (type == "lambertian")
+        {
+            m.type = material_type::lambertian;
+            if (!numbers(m.albedo, 3))
+                return fail("lambertian needs an albedo r g b");
+        }
+        else if (type == "metal")
+        {
+            m.type = material_type::metal;
+            if (!numbers(m.albedo, 3) || !number(m.parameter))
+                return fail("metal needs an albedo r g b and a fuzz");
+        }
+        else if (type == "dielectric")
+        {
+            m.type = material_type::dielectric;
+            if (!number(m.parameter) || m.parameter <= 0)
+                return fail("dielectric needs an index of refraction");
+        }
+        else
+        {
+            return fail("unknown material '" + std::string(type) + "'");
+        }
+        s.materials.push_back(m);
+        return true;
+    }
+
+    bool parse_material_statement(scene &s)
+    {
+        auto name_token = word();
+        if (name_token.empty())
+            return fail("material needs a name");
+        if (!parse_material(s))
+            return false;
+        auto index           = static_cast<std::uint32_t>(s.materials.size() - 1);
+        auto [entry, is_new] = names.emplace(name_token, index);
+        if (!is_new)
+            entry->second = index;
+        return true;
+    }
+
+    bool parse_sphere(scene &s)
+    {
+        sphere_record sphere{};
+        if (!numbers(sphere.center, 3) || !number(sphere.radius) || sphere.radius <= 0)
+            return fail("sphere needs a center x y z and a positive radius");
+
+        // The common case of a named material is a single hash lookup; an
+        // unknown name is taken as the start of an inline material.
+        auto save = pos;
+        auto ref  = word();
+        if (auto found = names.find(ref); found != names.end())
+        {
+            sphere.material = found->second;
+        }
+        else
+        {
+            pos = save;
+            if (!parse_material(s))
+                return false;
+            sphere.material = static_cast<std::uint32_t>(s.materials.size() - 1);
+        }
+        s.spheres.push_back(sphere);
+        return true;
+    }
+
+    bool parse_camera(scene_camera &camera)
+    {
+        while (!at_line_end())
+        {
+            auto key = word();
+            bool ok  = false;
+            if (key == "lookfrom")
+                ok = vector(camera.lookfrom);
+            else if (key == "lookat")
+                ok = vector(camera.lookat);
+            else if (key == "vup")
+                ok = vector(camera.vup);
+            else if (key == "vfov")
+                ok = number(camera.vfov) && camera.vfov > 0 && camera.vfov < 180;
+            else if (key == "aperture")
+                ok = number(camera.aperture) && camera.aperture >= 0;
+            else if (key == "focus_dist")
+                ok = number(camera.focus_dist) && camera.focus_dist > 0;
+            else
+                return fail("unknown camera setting '" + std::string(key) + "'");
+            if (!ok)
+                return fail("bad value for camera " + std::string(key));
+        }
+        return true;
+    }
+
+    bool parse_render(scene &s)
+    {
+        while (!at_line_end())
+        {
+            auto key   = word();
+            int *value = nullptr;
+            int  least = 1;
+            if (key == "width")
+                value = &s.image_width;
+            else if (key == "height")
+                value = &s.image_height;
+            else if (key == "samples")
+                value = &s.samples_per_pixel;
+            else if (key == "max_depth")
+                value = &s.max_depth;
+            else
+                return fail("unknown render setting '" + std::string(key) + "'");
+            if (key == "width" || key == "height")
+                least = 2;
+            if (!number(*value) || *value < least)
+                return fail("bad value for render " + std::string(key));
+        }
+        return true;
+    }
+
+    // True if nothing but a comment is left on the line; does not consume it.
+    bool at_line_end()
+    {
+        skip_blanks();
+        return pos == end || *pos == '\n';
+    }
+
+    bool fail(const std::string &message)
+    {
+        int line = 1;
+        for (auto p = begin; p < pos && p < end; ++p)
+            line += *p == '\n';
+        err << name << ':' << line << ": " << message << '\n';
+        return false;
+    }
+
+    const char                         *begin;
+    const char                         *pos;
+    const char                         *end;
+    std::string                         name;
+    std::ostream                       &err;
+    std::pmr::monotonic_buffer_resource arena;
+    material_names                      names;
+};
+
+// Read and parse a scene file.  Returns false, after reporting the problem on
+// err, if it cannot be read or is malformed.
+inline bool read_text_scene(const std::string &path, scene &s, std::ostream &err)
+{
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in)
+    {
+        err << "Cannot open scene " << path << '\n';
+        return false;
+    }
+
+    // A pipe has no size, and a directory opens with one it cannot be read at.
+    std::error_code ec;
+    auto            size = in.tellg();
+    if (size < 0 || !std::filesystem::is_regular_file(path, ec))
+    {
+        err << "Cannot read scene " << path << '\n';
+        return false;
+    }
+    std::string text(static_cast<std::size_t>(size), '\0');
+    in.seekg(0);
+    if (!in.read(text.data(), static_cast<std::streamsize>(text.size())))
+    {
+        err << "Cannot read scene " << path << '\n';
+        return false;
+    }
+
+    scene_parser parser(text, path, err);
+    return parser.parse(s);
+}
+
+#endif
@@ -0,0 +1,271 @@
+#ifndef SCENE_GENERATOR_H
+#define SCENE_GENERATOR_H
+
+#include "flat_scene.h"
+#include "scene_file.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// The final scene's sphere field grown to any number of spheres, for
+// stressing the BVH and memory with scenes far larger than 22x22.
+//
+// The field is a grid of square cells, each holding at most one small sphere
+// placed by throwing darts at the cell until one lands far enough from the
+// spheres in the eight cells around it (Poisson-disk sampling; a cell is at
+// least the minimum spacing wide, so no sphere further away can be too
+// close).  Cells are filled in four phases by the parity of their column and
+// row: cells of one phase are never neighbours, so a phase's cells can be
+// filled in parallel, each seeing only spheres from earlier phases.  Every
+// cell draws from its own random stream keyed by the seed and its position,
+// so the scene does not depend on the number of threads.
+//
+// The ground is a sphere large enough that the field sits on its top, and
+// the final scene's three large spheres stand in the middle.  Small spheres
+// share a palette of materials rather than having one each, which keeps
+// ten million of them to a few hundred megabytes.
+
+struct generator_settings
+{
+    std::size_t   spheres = 484;
+    double        density = 1.0;                 // small spheres per unit area
+    double        mix[3]  = {0.80, 0.15, 0.05}; // diffuse, metal, glass
+    std::uint64_t seed    = 0;
+};
+
+constexpr double generated_radius  = 0.2;
+constexpr double generated_spacing = 2 * generated_radius + 0.05;
+
+// Cells narrower than the spacing could hold spheres too close to ones two
+// cells away, which the phases do not guard against.
+inline double max_generated_density()
+{
+    return 1.0 / (generated_spacing * generated_spacing);
+}
+
+// A splitmix64 stream, cheap enough to start one per cell.
+class cell_random
+{
+  public:
+    explicit cell_random(std::uint64_t key) : state{mix(key)} {}
+
+    static std::uint64_t mix(std::uint64_t z)
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    std::uint64_t next()
+    {
+        state += 0x9e3779b97f4a7c15ULL;
+        return mix(state);
+    }
+
+    // Uniform in [min, max).
+    double uniform(double min = 0.0, double max = 1.0)
+    {
+        return min + (max - min) * static_cast<double>(next() >> 11) * 0x1.0p-53;
+    }
+
+  private:
+    std::uint64_t state;
+};
+
+class scene_generator
+{
+  public:
+    scene_generator(const generator_settings &settings, scene &out) : g{settings}, s{out}
+    {
+        cell     = 1.0 / std::sqrt(g.density);
+        columns  = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(g.spheres))));
+        rows     = columns == 0 ? 0 : (g.spheres + columns - 1) / columns;
+        auto far = 0.5 * cell * std::hypot(static_cast<double>(columns), static_cast<double>(rows));
+        ground   = std::max(1000.0, 2.0 * far);
+
+        double total  = g.mix[0] + g.mix[1] + g.mix[2];
+        diffuse_share = g.mix[0] / total;
+        metal_share   = (g.mix[0] + g.mix[1]) / total;
+    }
+
+    void generate(int thread_count)
+    {
+        s.spheres.clear();
+        s.materials.clear();
+        make_materials();
+
+        // Slot 0 is the ground and slot 1 + c holds cell c's sphere, if any
+        // (radius 0 until one is placed).
+        s.spheres.assign(1 + g.spheres, sphere_record{});
+        s.spheres[0] = record(point3(0, -ground, 0), ground, 0);
+
+        for (int phase = 0; phase < 4; ++phase)
+        {
+            std::size_t phase_rows = (rows + 1 - phase / 2) / 2;
+            int         parts      = static_cast<int>(std::max<std::size_t>(1, std::min<std::size_t>(thread_count, phase_rows)));
+            auto        fill       = [&, phase](int part)
+            {
+                for (auto r = phase_rows * part / parts; r < phase_rows * (part + 1) / parts; ++r)
+                {
+                    for (std::size_t x = phase % 2; x < columns; x += 2)
+                        fill_cell(x, 2 * r + phase / 2);
+                }
+            };
+
+            std::vector<std::thread> workers;
+            for (int part = 1; part < parts; ++part)
+                workers.emplace_back(fill, part);
+            fill(0);
+            for (auto &w : workers)
+                w.join();
+        }
+
+        std::erase_if(s.spheres, [](const sphere_record &r) { return r.radius == 0; });
+        for (int k = 0; k < 3; ++k)
+            s.spheres.push_back(record(large_centres[k], 1.0, 1 + k));
+    }
+
+  private:
+    static constexpr int           darts           = 16;
+    static constexpr std::uint32_t palette_size    = 256;
+    static constexpr std::uint32_t palette_first   = 4;
+    static constexpr double        large_clearance = 1.0 + generated_radius + 0.05;
+
+    inline static const point3 large_centres[3] = {point3(0, 1, 0), point3(-4, 1, 0), point3(4, 1, 0)};
+
+    static sphere_record record(const point3 &center, double radius, std::uint32_t material)
+    {
+        sphere_record r{};
+        r.center[0] = center.x();
+        r.center[1] = center.y();
+        r.center[2] = center.z();
+        r.radius    = radius;
+        r.material  = material;
+        return r;
+    }
+
+    void add_material(material_type type, const color &albedo, double parameter)
+    {
+        material_record m{};
+        m.type      = type;
+        m.albedo[0] = albedo.x();
+        m.albedo[1] = albedo.y();
+        m.albedo[2] = albedo.z();
+        m.parameter = parameter;
+        s.materials.push_back(m);
+    }
+
+    // The ground and the three large spheres' materials, as in the final
+    // scene, then the palettes: diffuse, metal and one glass.
+    void make_materials()
+    {
+        add_material(material_type::lambertian, color(0.5, 0.5, 0.5), 0);
+        add_material(material_type::dielectric, color(), 1.5);
+        add_material(material_type::lambertian, color(0.4, 0.2, 0.1), 0);
+        add_material(material_type::metal, color(0.7, 0.6, 0.5), 0.0);
+
+        cell_random rng(g.seed ^ 0x5eedULL);
+        auto        random_color = [&](double min, double max)
+        {
+            auto red   = rng.uniform(min, max);
+            auto green = rng.uniform(min, max);
+            return color(red, green, rng.uniform(min, max));
+        };
+        for (std::uint32_t i = 0; i < palette_size; ++i)
+        {
+            auto albedo = random_color(0, 1);
+            add_material(material_type::lambertian, albedo * random_color(0, 1), 0);
+        }
+        for (std::uint32_t i = 0; i < palette_size; ++i)
+        {
+            auto albedo = random_color(0.5, 1);
+            add_material(material_type::metal, albedo, rng.uniform(0, 0.5));
+        }
+        add_material(material_type::dielectric, color(), 1.5);
+    }
+
+    std::uint32_t pick_material(cell_random &rng) const
+    {
+        auto choose = rng.uniform();
+        auto index  = static_cast<std::uint32_t>(rng.next() % palette_size);
+        if (choose < diffuse_share)
+            return palette_first + index;
+        if (choose < metal_share)
+            return palette_first + palette_size + index;
+        return palette_first + 2 * palette_size;
+    }
+
+    bool clear_of_neighbours(std::size_t x, std::size_t y, double px, double pz) const
+    {
+        for (std::size_t ny = y == 0 ? 0 : y - 1; ny <= std::min(y + 1, rows - 1); ++ny)
+        {
+            for (std::size_t nx = x == 0 ? 0 : x - 1; nx <= std::min(x + 1, columns - 1); ++nx)
+            {
+                auto c = ny * columns + nx;
+                if (c >= g.spheres || (nx == x && ny == y))
+                    continue;
+                const auto &n = s.spheres[1 + c];
+                double dx = n.center[0] - px;
+                double dz = n.center[2] - pz;
+                if (n.radius != 0 && dx * dx + dz * dz < generated_spacing * generated_spacing)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    void fill_cell(std::size_t x, std::size_t y)
+    {
+        auto c = y * columns + x;
+        if (c >= g.spheres)
+            return;
+
+        cell_random rng(g.seed * 0x100000001b3ULL + cell_random::mix(c));
+        double      x0 = (static_cast<double>(x) - 0.5 * static_cast<double>(columns)) * cell;
+        double      z0 = (static_cast<double>(y) - 0.5 * static_cast<double>(rows)) * cell;
+        for (int d = 0; d < darts; ++d)
+        {
+            double px = x0 + rng.uniform(0, cell);
+            double pz = z0 + rng.uniform(0, cell);
+
+            bool clear = true;
+            for (const auto &l : large_centres)
+            {
+                double dx = l.x() - px;
+                double dz = l.z() - pz;
+                clear     = clear && dx * dx + dz * dz >= large_clearance * large_clearance;
+            }
+            if (!clear || !clear_of_neighbours(x, y, px, pz))
+                continue;
+
+            // On the ground sphere's surface, however far out the field goes.
+            double py        = std::sqrt(ground * ground - px * px - pz * pz) - ground + generated_radius;
+            s.spheres[1 + c] = record(point3(px, py, pz), generated_radius, pick_material(rng));
+            return;
+        }
+    }
+
+    const generator_settings &g;
+    scene                    &s;
+    double                    cell;
+    std::size_t               columns;
+    std::size_t               rows;
+    double                    ground;
+    double                    diffuse_share;
+    double                    metal_share;
+};
+
+// Replace the spheres and materials of s with a generated field.  The
+// camera and image settings are left alone.  Fewer spheres than asked for
+// result if some cells cannot fit one, which happens only near the largest
+// density.
+inline void generate_scene(const generator_settings &settings, scene &s, int thread_count)
+{
+    scene_generator(settings, s).generate(thread_count);
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "traversal_stats.h"
 #include "vec3.h"
 
 class material;
@@ -55,6 +56,7 @@ class sphere : public hittable
 
 bool sphere::hit(const ray &r, double t_min, double t_max, hit_record &rec) const
 {
+    count_primitive_tests(1);
     vec3 oc     = r.origin() - center;
     auto a      = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -82,7 +84,7 @@ bool sphere::hit(const ray &r, double t_min, double t_max, hit_record &rec) cons
     rec.p               = r.at(rec.t);
     vec3 outward_normal = (rec.p - center) / radius;
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mat_ptr;
+    rec.mat_ptr = mat_ptr.get();
 
     return true;
 }
@@ -0,0 +1,82 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Bounded lock-free queue between exactly one producer thread and one
+// consumer thread, used to hand work down the output pipeline.
+//
+// head and tail only ever increase; slot i % capacity holds item i.  Each
+// index is written by one side only, so push and pop are a load, a copy and a
+// release store with no lock.  When the queue is full (or empty) the blocking
+// push (or pop) sleeps on the other side's index with std::atomic::wait
+// instead of spinning, and every update notifies any sleeper.
+
+template <typename T>
+class spsc_queue
+{
+  public:
+    explicit spsc_queue(std::size_t capacity) : slots(capacity) {}
+
+    spsc_queue(const spsc_queue &)            = delete;
+    spsc_queue &operator=(const spsc_queue &) = delete;
+
+    std::size_t capacity() const { return slots.size(); }
+
+    bool try_push(const T &value)
+    {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == slots.size())
+            return false;
+        slots[t % slots.size()] = value;
+        tail.store(t + 1, std::memory_order_release);
+        tail.notify_one();
+        return true;
+    }
+
+    bool try_pop(T &value)
+    {
+        auto h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        value = slots[h % slots.size()];
+        head.store(h + 1, std::memory_order_release);
+        head.notify_one();
+        return true;
+    }
+
+    // Wait for room, then append value.
+    void push(const T &value)
+    {
+        while (!try_push(value))
+        {
+            auto h = head.load(std::memory_order_acquire);
+            if (tail.load(std::memory_order_relaxed) - h == slots.size())
+                head.wait(h, std::memory_order_acquire);
+        }
+    }
+
+    // Wait for an item, then remove and return it.
+    T pop()
+    {
+        T value;
+        while (!try_pop(value))
+        {
+            auto t = tail.load(std::memory_order_acquire);
+            if (head.load(std::memory_order_relaxed) == t)
+                tail.wait(t, std::memory_order_acquire);
+        }
+        return value;
+    }
+
+  private:
+    std::vector<T> slots;
+
+    // Kept on separate cache lines so the two threads do not contend for one.
+    alignas(64) std::atomic<std::size_t> head{0};
+    alignas(64) std::atomic<std::size_t> tail{0};
+};
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef STRIP_RENDER_H
+#define STRIP_RENDER_H
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "metrics.h"
+#include "perf_counters.h"
+#include "ppm.h"
+#include "region.h"
+#include "render.h"
+#include "spsc_queue.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Bounded-memory rendering for images too large to hold in memory.
+//
+// The region's bounding box is cut into horizontal strips.  All workers render
+// the tiles of one strip, tone-mapping each finished tile straight into an 8-bit
+// strip buffer.  The finished strip is queued for an encoder thread and the
+// workers move on to the next strip in a second buffer, so encoding one strip
+// overlaps rendering the next and the workers only wait if the encoder falls a
+// whole strip behind.  Only the strip buffers (3 bytes per pixel) and one float
+// tile per worker are ever resident, so the memory limit, not the image size,
+// decides how much is held at once.
+
+// One strip is encoded while the next is rendered.
+const int strip_buffers = 2;
+
+// Bytes held while rendering strips of the given height.
+inline std::size_t strip_memory(int width, int strip_rows, int tile_size, int thread_count)
+{
+    auto strip = static_cast<std::size_t>(width) * strip_rows * 3 * strip_buffers;
+    auto tiles = static_cast<std::size_t>(thread_count) * tile_size * tile_size * 3 * sizeof(float);
+    return strip + tiles;
+}
+
+// The tallest strip that fits in max_memory bytes, or 0 if not even a single
+// row per buffer fits.  Strips are rounded down to whole tile rows when they
+// can be, so tiles are not split between strips.
+inline int strip_rows_for(std::size_t max_memory, int width, int height, int tile_size, int thread_count)
+{
+    if (strip_memory(width, 1, tile_size, thread_count) > max_memory)
+        return 0;
+
+    auto fixed = strip_memory(width, 0, tile_size, thread_count);
+    auto rows  = (max_memory - fixed) / (static_cast<std::size_t>(width) * 3 * strip_buffers);
+    rows       = std::min(rows, static_cast<std::size_t>(height));
+    if (rows >= static_cast<std::size_t>(tile_size))
+        rows -= rows % tile_size;
+    return static_cast<int>(rows);
+}
+
+// Render the region strip by strip and encode it to out in any format but
+// PFM.  Returns false if no strip fits in max_memory.
+inline bool render_strips(const camera &cam, const hittable &world, const render_settings &settings,
+                          const render_region &region, int tile_size, int thread_count, std::size_t max_memory,
+                          std::ostream &out, image_format format, const std::vector<std::string> &comments,
+                          const tonemap &tone)
+{
+    auto bounds = region.bounds();
+    int  width  = bounds.width();
+    int  rows   = strip_rows_for(max_memory, width, bounds.height(), tile_size, thread_count);
+    if (rows == 0)
+    {
+        std::cerr << "--max-memory of " << max_memory << " bytes cannot hold " << strip_buffers << " rows of " << width
+                  << " pixels plus a tile per thread (" << strip_memory(width, 1, tile_size, thread_count)
+                  << " bytes).\n";
+        return false;
+    }
+
+    // A strip rows high in buffers[buffer], or the end of the image if rows is 0.
+    struct strip_job
+    {
+        int buffer = 0;
+        int rows   = 0;
+    };
+
+    std::vector<std::vector<std::uint8_t>> buffers(strip_buffers, std::vector<std::uint8_t>(static_cast<std::size_t>(width) * rows * 3));
+    spsc_queue<int>                        empty(strip_buffers);
+    spsc_queue<strip_job>                  finished(strip_buffers + 1);
+    int                                    strips = (bounds.height() + rows - 1) / rows;
+    for (int b = 0; b < strip_buffers; ++b)
+        empty.push(b);
+
+    std::cerr << "Rendering " << strips << " strips of " << rows << " rows ("
+              << strip_memory(width, rows, tile_size, thread_count) / (1024 * 1024) << " MiB of image buffers).\n";
+
+    auto encoder = make_encoder(out, format, width, bounds.height(), comments, thread_count);
+
+    std::thread encode(
+        [&]()
+        {
+            trace_track track("strip encoder");
+            perf_scope  counters(perf_phase::output);
+            for (auto job = finished.pop(); job.rows > 0; job = finished.pop())
+            {
+                trace_span span("encode strip", "output", {{"rows", job.rows}});
+                encoder->write_rows(buffers[job.buffer].data(), job.rows);
+                out.flush();
+                empty.push(job.buffer);
+            }
+            trace_span span("finish encoding", "output");
+            encoder->finish();
+        });
+
+    for (int s = 0; s < strips; ++s)
+    {
+        pixel_rect band{bounds.x0, bounds.y0 + s * rows, bounds.x1, std::min(bounds.y0 + (s + 1) * rows, bounds.y1)};
+        auto       part  = region.clipped(band);
+        int        b     = empty.pop();
+        auto      &strip = buffers[b];
+        trace_span span("strip", "render", {{"y", band.y0}, {"rows", band.height()}});
+
+        // Pixels outside the region stay black.
+        std::memset(strip.data(), 0, strip.size());
+        render_tiles(
+            cam, world, settings, part, tile_size, thread_count,
+            [&](const pixel_rect &tile, const framebuffer &pixels)
+            {
+                for (int y = 0; y < pixels.height(); ++y)
+                {
+                    auto offset = (static_cast<std::size_t>(tile.y0 - band.y0 + y) * width + (tile.x0 - band.x0)) * 3;
+                    tone.apply(pixels.row(y), strip.data() + offset, static_cast<std::size_t>(pixels.width()) * 3);
+                }
+            });
+        finished.push({b, band.height()});
+    }
+    finished.push({});
+    encode.join();
+    render_status.close(std::cerr);
+    encoder->report(std::cerr, format);
+    return true;
+}
+
+#endif
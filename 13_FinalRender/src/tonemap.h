@@ -0,0 +1,95 @@
+#ifndef TONEMAP_H
+#define TONEMAP_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+// Transfer curves for converting linear radiance to 8-bit output.  gamma2 is
+// the square root the renderer has always used; srgb is the piecewise curve
+// displays and image viewers assume.
+enum class transfer_curve
+{
+    gamma2,
+    srgb
+};
+
+inline bool parse_transfer_curve(const std::string &name, transfer_curve &curve)
+{
+    if (name == "gamma2")
+        curve = transfer_curve::gamma2;
+    else if (name == "srgb")
+        curve = transfer_curve::srgb;
+    else
+        return false;
+    return true;
+}
+
+// Converts runs of linear floats to bytes: scale by the exposure, apply the
+// transfer curve and map [0,1) onto [0,255].
+//
+// Both curves start with a branch-free pass over contiguous floats that the
+// compiler turns into packed multiply/max/min/sqrt instructions.  gamma2 is
+// finished right there.  srgb is too costly to evaluate per channel, so the
+// square root is used as the index into a table of the curve: sqrt spreads
+// the entries towards the dark end where the curve is steepest, and 4096 of
+// them keep every output within one step of the exact value.
+class tonemap
+{
+  public:
+    tonemap(transfer_curve c = transfer_curve::gamma2, double exposure_stops = 0.0)
+        : curve{c}, scale{static_cast<float>(std::exp2(exposure_stops))}
+    {
+        if (curve == transfer_curve::srgb)
+        {
+            for (int i = 0; i < lut_size; ++i)
+            {
+                double u = static_cast<double>(i) / (lut_size - 1);
+                double x = u * u;
+                double s = x <= 0.0031308 ? 12.92 * x : 1.055 * std::pow(x, 1.0 / 2.4) - 0.055;
+                lut[i]   = static_cast<std::uint8_t>(256.0 * std::min(s, 0.999));
+            }
+        }
+    }
+
+    void apply(const float *src, std::uint8_t *dst, std::size_t count) const
+    {
+        if (curve == transfer_curve::gamma2)
+        {
+            for (std::size_t k = 0; k < count; ++k)
+            {
+                float v = std::sqrt(std::max(src[k] * scale, 0.0f));
+                v       = std::min(v, 0.999f);
+                dst[k]  = static_cast<std::uint8_t>(256.0f * v);
+            }
+            return;
+        }
+
+        // Indices are computed a block at a time so that loop stays
+        // vectorized; only the table lookups are scalar.
+        const std::size_t block = 1024;
+        std::int32_t      index[block];
+        for (std::size_t start = 0; start < count; start += block)
+        {
+            auto n = std::min(block, count - start);
+            for (std::size_t k = 0; k < n; ++k)
+            {
+                float u  = std::sqrt(std::min(std::max(src[start + k] * scale, 0.0f), 1.0f));
+                index[k] = static_cast<std::int32_t>(u * (lut_size - 1) + 0.5f);
+            }
+            for (std::size_t k = 0; k < n; ++k)
+                dst[start + k] = lut[index[k]];
+        }
+    }
+
+  private:
+    static constexpr int lut_size = 4096;
+
+    transfer_curve                     curve;
+    float                              scale;
+    std::array<std::uint8_t, lut_size> lut = {};
+};
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A timeline of the render for chrome://tracing or ui.perfetto.dev: scene
+// setup, the BVH build, every tile on every worker, encoding and file
+// writes, each a span on the track of the thread that did it.  Scheduler
+// imbalance shows as ragged track ends, stragglers as long tiles and I/O
+// stalls as gaps on the writer tracks.
+//
+// Tracing is off unless --trace starts it.  Each thread appends its spans to
+// a buffer of its own, so recording takes no lock; the buffers are only
+// gathered when the trace is written.  A span that is not recorded costs a
+// relaxed load of the enabled flag.
+//
+// Tracks are named rather than tied to threads: the workers of successive
+// render_tiles calls reuse "worker 1", "worker 2" and so on, so a strip or
+// animation render does not grow a new track per strip or frame.
+
+struct trace_arg
+{
+    const char  *name  = nullptr;
+    std::int64_t value = 0;
+};
+
+struct trace_event
+{
+    const char  *name;
+    const char  *category;
+    int          track;
+    std::int64_t start_ns;
+    std::int64_t duration_ns;
+    trace_arg    args[4];
+};
+
+class trace_recorder
+{
+  public:
+    trace_recorder() { track_names.push_back("main"); }
+
+    void start()
+    {
+        origin = std::chrono::steady_clock::now();
+        on.store(true, std::memory_order_relaxed);
+    }
+
+    bool enabled() const { return on.load(std::memory_order_relaxed); }
+
+    std::int64_t now() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    // The number of the track called name, created on first use.
+    int track(const std::string &name)
+    {
+        std::lock_guard guard(lock);
+        for (std::size_t i = 0; i < track_names.size(); ++i)
+        {
+            if (track_names[i] == name)
+                return static_cast<int>(i);
+        }
+        track_names.push_back(name);
+        return static_cast<int>(track_names.size() - 1);
+    }
+
+    void record(const trace_event &e) { buffer().push_back(e); }
+
+    // Write every span recorded so far as Chrome trace-event JSON.  Returns
+    // false, after reporting the problem on err, if it cannot be written.
+    bool write(const std::string &path, std::ostream &err)
+    {
+        std::ofstream out(path);
+        if (!out)
+        {
+            err << "Could not open trace file " << path << '\n';
+            return false;
+        }
+
+        std::lock_guard guard(lock);
+        std::size_t     spans = 0;
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        for (std::size_t t = 0; t < track_names.size(); ++t)
+        {
+            out << (t == 0 ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+                << ",\"args\":{\"name\":\"" << track_names[t] << "\"}},\n"
+                << "{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+                << ",\"args\":{\"sort_index\":" << t << "}}";
+        }
+        for (const auto &b : buffers)
+        {
+            for (const auto &e : *b)
+            {
+                out << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"" << e.category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                    << e.track << ",\"ts\":" << microseconds(e.start_ns) << ",\"dur\":" << microseconds(e.duration_ns);
+                if (e.args[0].name != nullptr)
+                {
+                    out << ",\"args\":{";
+                    for (int a = 0; a < 4 && e.args[a].name != nullptr; ++a)
+                        out << (a == 0 ? "" : ",") << '"' << e.args[a].name << "\":" << e.args[a].value;
+                    out << '}';
+                }
+                out << '}';
+                ++spans;
+            }
+        }
+        out << "\n]}\n";
+        out.close();
+        if (!out)
+        {
+            err << "Could not write trace file " << path << '\n';
+            return false;
+        }
+        err << "Wrote " << spans << " trace spans on " << track_names.size() << " tracks to " << path << ".\n";
+        return true;
+    }
+
+    // The track the calling thread's spans go on.
+    inline static thread_local int current_track = 0;
+
+  private:
+    // Nanoseconds as microseconds with three decimals, without going through
+    // floating point.
+    static std::string microseconds(std::int64_t ns)
+    {
+        auto fraction = std::to_string(1000 + ns % 1000);
+        return std::to_string(ns / 1000) + '.' + fraction.substr(1);
+    }
+
+    std::vector<trace_event> &buffer()
+    {
+        thread_local std::vector<trace_event> *mine = nullptr;
+        if (mine == nullptr)
+        {
+            std::lock_guard guard(lock);
+            buffers.push_back(std::make_unique<std::vector<trace_event>>());
+            mine = buffers.back().get();
+            mine->reserve(1024);
+        }
+        return *mine;
+    }
+
+    std::atomic<bool>                                      on{false};
+    std::chrono::steady_clock::time_point                  origin;
+    std::mutex                                             lock;
+    std::vector<std::string>                               track_names;
+    std::vector<std::unique_ptr<std::vector<trace_event>>> buffers;
+};
+
+inline trace_recorder tracer;
+
+// Puts the calling thread's spans on the named track while it exists, such
+// as "worker 3" for index 3 of "worker".
+class trace_track
+{
+  public:
+    explicit trace_track(const char *name, int index = -1) : previous{trace_recorder::current_track}
+    {
+        if (tracer.enabled())
+            trace_recorder::current_track = tracer.track(index < 0 ? name : name + (' ' + std::to_string(index)));
+    }
+    ~trace_track() { trace_recorder::current_track = previous; }
+
+  private:
+    int previous;
+};
+
+// Records the time from construction to destruction, or to end, as a span
+// named name on the calling thread's track.  name, category and argument
+// names must be string literals, since only the pointers are kept.
+class trace_span
+{
+  public:
+    trace_span(const char *name, const char *category, std::initializer_list<trace_arg> args = {})
+    {
+        if (!tracer.enabled())
+            return;
+        event = trace_event{name, category, trace_recorder::current_track, tracer.now(), 0, {}};
+        int a = 0;
+        for (const auto &arg : args)
+        {
+            if (a < 4)
+                event.args[a++] = arg;
+        }
+        recording = true;
+    }
+
+    ~trace_span() { end(); }
+
+    void end()
+    {
+        if (!recording)
+            return;
+        event.duration_ns = tracer.now() - event.start_ns;
+        tracer.record(event);
+        recording = false;
+    }
+
+  private:
+    trace_event event{};
+    bool        recording = false;
+};
+
+#endif
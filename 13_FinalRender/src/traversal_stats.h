@@ -0,0 +1,161 @@
+#ifndef TRAVERSAL_STATS_H
+#define TRAVERSAL_STATS_H
+
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+
+// What each ray costs the scene: bounding boxes and primitives tested, how
+// often something was hit, how long paths get and why they end.  For
+// comparing accelerators and scenes, not for production renders.
+//
+// Configure with -DRT_STATS=ON to count.  Each thread counts into its own
+// plain counters, which are added to the totals when the thread exits, so
+// counting needs neither atomics nor shared cache lines.  In ordinary builds
+// the counting functions are empty and inline, and compile away completely.
+
+// Paths longer than this are counted in the last bucket.
+const int path_length_buckets = 64;
+
+enum class path_end
+{
+    escaped,     // left the scene into the sky
+    absorbed,    // a material did not scatter it
+    depth_limit, // reached max_depth bounces
+    count
+};
+
+struct traversal_counts
+{
+    std::uint64_t box_tests       = 0;
+    std::uint64_t primitive_tests = 0;
+    std::uint64_t rays            = 0; // queries of the world, one per path segment
+    std::uint64_t hits            = 0; // queries that found a surface
+    std::uint64_t path_lengths[path_length_buckets] = {};
+    std::uint64_t path_ends[static_cast<int>(path_end::count)] = {};
+
+    void add(const traversal_counts &o)
+    {
+        box_tests += o.box_tests;
+        primitive_tests += o.primitive_tests;
+        rays += o.rays;
+        hits += o.hits;
+        for (int i = 0; i < path_length_buckets; ++i)
+            path_lengths[i] += o.path_lengths[i];
+        for (int i = 0; i < static_cast<int>(path_end::count); ++i)
+            path_ends[i] += o.path_ends[i];
+    }
+};
+
+#ifdef RT_STATS
+
+const bool traversal_stats = true;
+
+// Totals of the threads that have exited.
+inline std::mutex       finished_stats_lock;
+inline traversal_counts finished_stats;
+
+struct thread_stats
+{
+    traversal_counts counts;
+    int              path_length = 0; // segments of the path being traced
+
+    ~thread_stats()
+    {
+        std::lock_guard lock(finished_stats_lock);
+        finished_stats.add(counts);
+    }
+};
+
+inline thread_local thread_stats this_thread_stats;
+
+inline void count_box_tests(std::uint64_t n) { this_thread_stats.counts.box_tests += n; }
+inline void count_primitive_tests(std::uint64_t n) { this_thread_stats.counts.primitive_tests += n; }
+
+inline void count_ray(bool hit)
+{
+    auto &s = this_thread_stats;
+    ++s.counts.rays;
+    s.counts.hits += hit;
+    ++s.path_length;
+}
+
+inline void count_path_end(path_end why)
+{
+    auto &s = this_thread_stats;
+    ++s.counts.path_lengths[s.path_length < path_length_buckets ? s.path_length : path_length_buckets - 1];
+    ++s.counts.path_ends[static_cast<int>(why)];
+    s.path_length = 0;
+}
+
+// Totals of the exited threads and the calling one.  Call once the workers
+// have been joined.
+inline traversal_counts collect_traversal_stats()
+{
+    std::lock_guard  lock(finished_stats_lock);
+    traversal_counts total = finished_stats;
+    total.add(this_thread_stats.counts);
+    return total;
+}
+
+#else
+
+const bool traversal_stats = false;
+
+inline void             count_box_tests(std::uint64_t) {}
+inline void             count_primitive_tests(std::uint64_t) {}
+inline void             count_ray(bool) {}
+inline void             count_path_end(path_end) {}
+inline traversal_counts collect_traversal_stats() { return {}; }
+
+#endif
+
+// Print the counts with their averages per ray and per path.  Does nothing
+// unless the statistics are built in.
+inline void report_traversal_stats(std::ostream &out)
+{
+    if (!traversal_stats)
+        return;
+
+    auto          c     = collect_traversal_stats();
+    std::uint64_t paths = 0;
+    std::uint64_t steps = 0;
+    for (int i = 0; i < path_length_buckets; ++i)
+    {
+        paths += c.path_lengths[i];
+        steps += c.path_lengths[i] * static_cast<std::uint64_t>(i);
+    }
+    auto per = [](std::uint64_t n, std::uint64_t d) { return d == 0 ? 0.0 : static_cast<double>(n) / static_cast<double>(d); };
+    auto pct = [&](std::uint64_t n, std::uint64_t d) { return 100.0 * per(n, d); };
+
+    auto flags = out.flags();
+    auto prec  = out.precision();
+    out << std::fixed << std::setprecision(2);
+    out << "Traversal statistics:\n"
+        << "  rays            " << c.rays << ", " << pct(c.hits, c.rays) << "% hit\n"
+        << "  box tests       " << c.box_tests << ", " << per(c.box_tests, c.rays) << " per ray\n"
+        << "  primitive tests " << c.primitive_tests << ", " << per(c.primitive_tests, c.rays) << " per ray\n"
+        << "  paths           " << paths << ", " << per(steps, paths) << " rays per path\n"
+        << "  path ends       " << pct(c.path_ends[static_cast<int>(path_end::escaped)], paths) << "% escaped, "
+        << pct(c.path_ends[static_cast<int>(path_end::absorbed)], paths) << "% absorbed, "
+        << pct(c.path_ends[static_cast<int>(path_end::depth_limit)], paths) << "% at the depth limit\n"
+        << "  path lengths   ";
+    // The long tail is summed, since few paths get far.
+    const int     shown  = 8;
+    std::uint64_t longer = 0;
+    for (int i = 0; i < path_length_buckets; ++i)
+    {
+        if (i > shown)
+            longer += c.path_lengths[i];
+        else if (c.path_lengths[i] != 0)
+            out << ' ' << i << ": " << pct(c.path_lengths[i], paths) << '%';
+    }
+    if (longer != 0)
+        out << " longer: " << pct(longer, paths) << '%';
+    out << '\n';
+    out.flags(flags);
+    out.precision(prec);
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include "image_encoder.h"
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Writes a sequence of equally sized 8-bit RGB frames as one uncompressed
+// video stream, for piping into an external encoder:
+//
+//   raytrace --animate path.txt --format y4m | ffmpeg -i - out.mp4
+//   raytrace --animate path.txt --format rgb | ffmpeg -f rawvideo -pix_fmt rgb24 -s 1200x800 -r 24 -i - out.mp4
+//
+// Y4M carries the size and frame rate in its header.  Frames are converted to
+// full-resolution 4:4:4 YCbCr with the BT.601 studio-range matrix, which is
+// what Y4M readers assume when the stream does not say otherwise.  RGB is the
+// frames back to back with no header at all.
+
+class video_writer
+{
+  public:
+    video_writer(std::ostream &o, image_format f, int w, int h, int fps) : out{o}, format{f}, width{w}, height{h}
+    {
+        if (format == image_format::Y4M)
+        {
+            out << "YUV4MPEG2 W" << width << " H" << height << " F" << fps << ":1 Ip A1:1 C444\n";
+            planes.resize(static_cast<std::size_t>(width) * height * 3);
+        }
+    }
+
+    void write_frame(const std::uint8_t *rgb)
+    {
+        auto pixels = static_cast<std::size_t>(width) * height;
+        if (format == image_format::RGB)
+        {
+            out.write(reinterpret_cast<const char *>(rgb), static_cast<std::streamsize>(pixels * 3));
+            return;
+        }
+
+        std::uint8_t *y  = planes.data();
+        std::uint8_t *cb = y + pixels;
+        std::uint8_t *cr = cb + pixels;
+        for (std::size_t k = 0; k < pixels; ++k)
+        {
+            int r = rgb[k * 3];
+            int g = rgb[k * 3 + 1];
+            int b = rgb[k * 3 + 2];
+            y[k]  = static_cast<std::uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            cb[k] = static_cast<std::uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            cr[k] = static_cast<std::uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+        out << "FRAME\n";
+        out.write(reinterpret_cast<const char *>(planes.data()), static_cast<std::streamsize>(planes.size()));
+    }
+
+  private:
+    std::ostream             &out;
+    image_format              format;
+    int                       width;
+    int                       height;
+    std::vector<std::uint8_t> planes;
+};
+
+#endif
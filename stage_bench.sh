@@ -0,0 +1,163 @@
+#!/bin/bash
+
+# Builds the tutorial stages 05 to 13 with the same compiler flags, image
+# size, sample count and bounce limit, times each render and reports the cost
+# per sample and what each stage adds to the one before it.
+#
+#   ./stage_bench.sh --width 200 --samples 20 --repetitions 3
+#
+# Stages 05 and 06 take one sample per pixel, as they have no anti-aliasing.
+# Stage 13 renders single-threaded so it is timed like the others.  The
+# difference between two stages includes any change the chapter made to its
+# scene, such as the extra spheres of 09 or the many of 13, and not only the
+# feature it introduced.  Each render is a whole process, so keep the image
+# large enough that starting it does not count.
+
+width=200
+samples=20
+max_depth=50
+repetitions=3
+build_dir=_stage_build
+json=
+history=
+
+usage()
+{
+    echo "Usage: $0 [options]"
+    echo
+    echo "  --width n            image width; the height is 9/16 of it (default 200)"
+    echo "  --samples n          samples per pixel from stage 07 on (default 20)"
+    echo "  --max-depth n        ray bounce limit from stage 08 on (default 50)"
+    echo "  --repetitions n      renders per stage, of which the median is kept (default 3)"
+    echo "  --build-dir dir      where the stages are built (default _stage_build)"
+    echo "  --json file          also write the results as JSON"
+    echo "  --history file       also append the results to a benchmark history file"
+    echo "  --help               show this message"
+}
+
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --help|-h) usage; exit 0 ;;
+        --width|--samples|--max-depth|--repetitions|--build-dir|--json|--history) ;;
+        *) echo "Unknown option $1" >&2; usage >&2; exit 1 ;;
+    esac
+    if [ $# -lt 2 ]; then
+        echo "Missing value for $1" >&2
+        exit 1
+    fi
+    case "$1" in
+        --width) width=$2 ;;
+        --samples) samples=$2 ;;
+        --max-depth) max_depth=$2 ;;
+        --repetitions) repetitions=$2 ;;
+        --build-dir) build_dir=$2 ;;
+        --json) json=$2 ;;
+        --history) history=$2 ;;
+    esac
+    shift 2
+done
+
+for value in "$width" "$samples" "$max_depth" "$repetitions"; do
+    if ! [[ "$value" =~ ^[1-9][0-9]*$ ]]; then
+        echo "Bad value '$value', expected a positive whole number" >&2
+        exit 1
+    fi
+done
+
+cd "$(dirname "$0")" || exit 1
+height=$((width * 9 / 16))
+
+stages=(05_SphereIntersection 06_NormalsAndMultipleObjects 07_AntiAliasing 08_DiffuseMaterials 09_Metal
+        10_Dielectrics 11_PositionableCamera 12_DefocusBlur 13_FinalRender)
+features=("sphere intersection" "normals, hittable list" "anti-aliasing" "diffuse bounces" "metal, fuzz"
+          "dielectric, Schlick" "positionable camera" "defocus blur" "final scene")
+
+# 13 sets these itself; passing them to every stage keeps the builds alike.
+flags="-fno-math-errno -fno-trapping-math -DSTAGE_IMAGE_WIDTH=$width -DSTAGE_SAMPLES_PER_PIXEL=$samples"
+flags="$flags -DSTAGE_MAX_DEPTH=$max_depth"
+
+mkdir -p "$build_dir" || exit 1
+log=$build_dir/build.log
+for stage in "${stages[@]}"; do
+    echo "Building $stage..." >&2
+    if ! cmake -S "$stage" -B "$build_dir/$stage" -DCMAKE_BUILD_TYPE=Release -DCMAKE_CXX_FLAGS="$flags" > "$log" 2>&1 ||
+       ! cmake --build "$build_dir/$stage" --target raytrace >> "$log" 2>&1; then
+        echo "Building $stage failed; see $log" >&2
+        exit 1
+    fi
+done
+
+# Nanoseconds of each render of stage $1, fastest first; the image goes to $2.
+time_stage()
+{
+    local stage=$1 image=$2 times=() r start end
+    local program=("$build_dir/$stage/raytrace")
+    if [ "$stage" = 13_FinalRender ]; then
+        program+=(--width "$width" --height "$height" --samples "$samples" --max-depth "$max_depth" --threads 1
+                  --format p3)
+    fi
+    for ((r = 0; r < repetitions; ++r)); do
+        start=$(date +%s%N)
+        if ! "${program[@]}" > "$image" 2> /dev/null; then
+            echo "$stage failed to render" >&2
+            return 1
+        fi
+        end=$(date +%s%N)
+        times+=($((end - start)))
+    done
+    printf '%s\n' "${times[@]}" | sort -n
+}
+
+printf '%-30s %-24s %10s %10s %12s %12s\n' stage feature samples ms ns/sample added
+# What the history records about the build and machine.
+revision=$(git rev-parse --short=12 HEAD 2> /dev/null || echo unknown)
+cpu=$(sed -n 's/^model name[[:space:]]*: //p' /proc/cpuinfo 2> /dev/null | sed -n 1p)
+compiler=$(${CXX:-c++} --version 2> /dev/null | sed -n 1p)
+run="$(date +%Y-%m-%dT%H:%M:%S%z)/$$"
+
+entries=()
+lines=()
+previous=
+for i in "${!stages[@]}"; do
+    stage=${stages[$i]}
+    times=($(time_stage "$stage" "$build_dir/$stage.ppm")) || exit 1
+    ns=${times[$((repetitions / 2))]}
+
+    # The size the stage actually wrote, in case it differs from the request.
+    read -r w h < <(grep -v '^#' "$build_dir/$stage.ppm" | sed -n 2p)
+    spp=$samples
+    case "$stage" in
+        05_*|06_*) spp=1 ;;
+    esac
+    count=$((w * h * spp))
+    per_sample=$((ns / count))
+    added=
+    if [ -n "$previous" ]; then
+        added=$(printf '%+d' $((per_sample - previous)))
+    fi
+    previous=$per_sample
+
+    printf '%-30s %-24s %10d %10d %12d %12s\n' "$stage" "${features[$i]}" "$count" $((ns / 1000000)) \
+        "$per_sample" "$added"
+    lines+=("{\"revision\": \"$revision\", \"date\": \"$(date +%Y-%m-%dT%H:%M:%S%z)\", \"run\": \"$run\", \"host\": \"$(hostname)\", \"cpu\": \"$cpu\", \"compiler\": \"$compiler\", \"flags\": \"$flags\", \"program\": \"$0\", \"name\": \"stage/$stage\", \"times\": [$(IFS=,; echo "${times[*]}")], \"counters\": {\"samples\": $count, \"ns_per_sample\": $per_sample}}")
+    entries+=("{\"name\": \"stage/$stage\", \"run_type\": \"aggregate\", \"aggregate_name\": \"median\", \"repetitions\": $repetitions, \"iterations\": 1, \"real_time\": $ns, \"cpu_time\": $ns, \"time_unit\": \"ns\", \"samples\": $count, \"ns_per_sample\": $per_sample, \"label\": \"${features[$i]}\"}")
+done
+
+if [ -n "$json" ]; then
+    {
+        echo "{"
+        echo "  \"context\": {\"date\": \"$(date +%Y-%m-%dT%H:%M:%S%z)\", \"host_name\": \"$(hostname)\", \"executable\": \"$0\", \"num_cpus\": $(nproc), \"library_build_type\": \"release\"},"
+        echo "  \"benchmarks\": ["
+        for i in "${!entries[@]}"; do
+            separator=,
+            [ "$i" -eq $((${#entries[@]} - 1)) ] && separator=
+            echo "    ${entries[$i]}$separator"
+        done
+        echo "  ]"
+        echo "}"
+    } > "$json"
+fi
+
+if [ -n "$history" ]; then
+    printf '%s\n' "${lines[@]}" >> "$history"
+fi